@@ -32,6 +32,7 @@
 #include "opencv2/opencv.hpp"
 
 #include "abstract-factory.h"
+#include "binarymask.h"
 #include "capture.h"
 #include "helpers.h"
 #include "source.h"
@@ -139,7 +140,8 @@ class Actuator
         std::vector<std::weak_ptr<Source>> mSources;
 
         // Methods
-        cv::Mat getMask(cv::Mat pCapture, int pInterpolation = CV_INTER_NN);
+        void applyMask(cv::Mat& pImg); // Masks pImg in place, whatever its type
+
         void setBaseParameter(const atom::Message pMessage);
         std::vector<cv::Mat> captureToMat(std::vector< Capture_Ptr > pCaptures);
 
@@ -148,7 +150,7 @@ class Actuator
         static std::string mDocumentation; //!< Class documentation, to be set in child class
         static unsigned int mSourceNbr; //!< Number of sources needed for the actuator, to be set in child class
 
-        cv::Mat mSourceMask, mMask;
+        MaskCache mMask;
 };
 
 #endif // ACTUATOR_H
@@ -31,6 +31,7 @@
 
 #include "capture.h"
 #include "config.h"
+#include "tonemapper.h"
 #if HAVE_SHMDATA
 #include <shmdata/any-data-writer.h>
 #endif
@@ -69,18 +70,21 @@ class LookupTable
         };
         LookupTable();
         LookupTable(interpolation inter, std::vector< std::vector<float> > keys);
-        void set(interpolation inter, std::vector< std::vector<float> > keys);
-        bool isSet() {return mIsSet;}
+        void set(interpolation inter, const std::vector< std::vector<float> >& keys);
+        bool isSet() const {return mIsSet;}
 
         float operator[](const float& value);
         float inverse(const float& value);
-        bool isOutOfRange() {return mOutOfRange;}
+        bool isOutOfRange() const {return mOutOfRange;}
 
     private:
         bool mIsSet;
         interpolation mInterpolation;
         float mStart[2], mEnd[2];
-        std::vector< std::vector<float> > mKeys;
+        // Keys, sorted by input value, stored as two contiguous arrays
+        std::vector<float> mKeysIn, mKeysOut;
+        // Same keys, sorted by output value for the inverse lookup
+        std::vector<float> mInverseIn, mInverseOut;
         bool mOutOfRange;
 };
 
@@ -105,9 +109,13 @@ class ShmAuto : public Shm
         ShmAuto(const char* filename);
         void setCapture(Capture_Ptr& capture, const unsigned long long timestamp = 0);
 
+        // If set, float images are tonemapped to 8 bits before being sent
+        void setTonemapper(std::shared_ptr<Tonemapper> tonemapper) {mTonemapper = tonemapper;}
+
     private:
         std::shared_ptr<Shm> mShm;
         std::string mFilename;
+        std::shared_ptr<Tonemapper> mTonemapper;
 };
 
 /*************/
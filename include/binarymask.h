@@ -0,0 +1,376 @@
+/*
+ * Copyright (C) 2013 Emmanuel Durand
+ *
+ * This file is part of blobserver.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * @binarymask.h
+ * BinaryMask, binary images stored with one bit per pixel, and fused morphology on them.
+ */
+
+#ifndef BINARYMASK_H
+#define BINARYMASK_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+/*************/
+// Binary image, each row being packed in 64 bits words
+// Pixel x of a row is bit (x % 64) of word (x / 64). Bits past the last column are always 0
+class BinaryMask
+{
+    public:
+        BinaryMask(): _rows(0), _cols(0), _words(0) {}
+
+        void create(int pRows, int pCols)
+        {
+            _rows = pRows;
+            _cols = pCols;
+            _words = (pCols + 63) / 64;
+            _data.assign((size_t)_rows * _words, 0);
+        }
+
+        int rows() const {return _rows;}
+        int cols() const {return _cols;}
+        int words() const {return _words;}
+        size_t total() const {return (size_t)_rows * _cols;}
+
+        uint64_t* row(int pY) {return _data.data() + (size_t)pY * _words;}
+        const uint64_t* row(int pY) const {return _data.data() + (size_t)pY * _words;}
+
+        // Mask of the valid bits of the last word of a row
+        uint64_t tail() const {return _cols % 64 ? (1ull << (_cols % 64)) - 1 : ~0ull;}
+
+        /**
+         * Number of set pixels
+         */
+        unsigned long long count() const
+        {
+            unsigned long long count = 0;
+            for (auto word : _data)
+                count += __builtin_popcountll(word);
+            return count;
+        }
+
+        /**
+         * Packs a 8 bits single channel image, pixels strictly above pThreshold being set
+         */
+        void fromMat(const cv::Mat& pSource, double pThreshold = 0.0);
+
+        /**
+         * Unpacks to a CV_8U image, set pixels being 255 and the others 0
+         */
+        void toMat(cv::Mat& pOutput) const;
+
+    private:
+        int _rows, _cols, _words;
+        std::vector<uint64_t> _data;
+};
+
+/*************/
+// Row kernels
+/*************/
+// Packs a row of 8 bits pixels, pixels strictly above pThreshold being set
+inline void packRow(const uchar* pSource, int pCols, int pThreshold, uint64_t* pOutput)
+{
+    const int words = (pCols + 63) / 64;
+    if (pThreshold < 0)
+    {
+        std::fill(pOutput, pOutput + words, ~0ull);
+    }
+    else if (pThreshold >= 255)
+    {
+        std::fill(pOutput, pOutput + words, 0ull);
+        return;
+    }
+    else
+    {
+        int x = 0;
+#if CV_SSE2
+        // Unsigned comparison, through a signed one on values offset by 128
+        const __m128i offset = _mm_set1_epi8((char)0x80);
+        const __m128i threshold = _mm_set1_epi8((char)(pThreshold ^ 0x80));
+        for (; x + 64 <= pCols; x += 64)
+        {
+            uint64_t word = 0;
+            for (int i = 0; i < 4; ++i)
+            {
+                __m128i pixels = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(pSource + x + i * 16)), offset);
+                uint64_t bits = (uint64_t)(unsigned int)_mm_movemask_epi8(_mm_cmpgt_epi8(pixels, threshold));
+                word |= bits << (i * 16);
+            }
+            pOutput[x / 64] = word;
+        }
+#endif
+        for (; x < pCols; x += 64)
+        {
+            uint64_t word = 0;
+            int length = std::min(64, pCols - x);
+            for (int i = 0; i < length; ++i)
+                word |= (uint64_t)(pSource[x + i] > pThreshold) << i;
+            pOutput[x / 64] = word;
+        }
+    }
+
+    if (pCols % 64)
+        pOutput[words - 1] &= (1ull << (pCols % 64)) - 1;
+}
+
+/*************/
+// Unpacks a row to 8 bits pixels, 255 for set pixels and 0 otherwise
+inline void unpackRow(const uint64_t* pSource, int pCols, uchar* pOutput)
+{
+    int x = 0;
+#if CV_SSE2
+    const __m128i pattern = _mm_set_epi8((char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+                                         (char)0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+    for (; x + 16 <= pCols; x += 16)
+    {
+        unsigned int bits = (unsigned int)(pSource[x / 64] >> (x % 64)) & 0xFFFF;
+        // Each byte of the 16 bits is spread over 8 bytes, then tested against its own bit
+        __m128i spread = _mm_set_epi64x((long long)(0x0101010101010101ull * (bits >> 8)), (long long)(0x0101010101010101ull * (bits & 0xFF)));
+        __m128i set = _mm_cmpeq_epi8(_mm_and_si128(spread, pattern), pattern);
+        _mm_storeu_si128((__m128i*)(pOutput + x), set);
+    }
+#endif
+    for (; x < pCols; ++x)
+        pOutput[x] = (pSource[x / 64] >> (x % 64)) & 1 ? 255 : 0;
+}
+
+/*************/
+// Gets word pWord of a row shifted by pShift pixels: bit i of the result is pixel (64 * pWord + i + pShift)
+// Pixels outside of the row have the value of pBorder (0 or ~0)
+inline uint64_t shiftedWord(const uint64_t* pRow, int pWords, int pWord, int pShift, uint64_t pBorder)
+{
+    int first = pWord + (pShift >= 0 ? pShift / 64 : -((-pShift + 63) / 64));
+    int bits = pShift - (first - pWord) * 64;
+
+    uint64_t low = first >= 0 && first < pWords ? pRow[first] : pBorder;
+    if (bits == 0)
+        return low;
+    uint64_t high = first + 1 >= 0 && first + 1 < pWords ? pRow[first + 1] : pBorder;
+    return (low >> bits) | (high << (64 - bits));
+}
+
+/*************/
+// Horizontal erosion (pDilate false) or dilation (pDilate true) of a row, by pRadius pixels on each side
+// pRow is modified: its padding bits are set to the border value
+inline void morphologyRow(uint64_t* pRow, int pCols, int pRadius, bool pDilate, uint64_t* pOutput)
+{
+    const int words = (pCols + 63) / 64;
+    const uint64_t tail = pCols % 64 ? (1ull << (pCols % 64)) - 1 : ~0ull;
+    // Out of the image pixels do not change the result, as with cv::erode and cv::dilate
+    const uint64_t border = pDilate ? 0ull : ~0ull;
+
+    if (pDilate)
+        pRow[words - 1] &= tail;
+    else
+        pRow[words - 1] |= ~tail;
+
+    for (int w = 0; w < words; ++w)
+    {
+        uint64_t value = pRow[w];
+        for (int s = 1; s <= pRadius; ++s)
+        {
+            if (pDilate)
+                value |= shiftedWord(pRow, words, w, s, border) | shiftedWord(pRow, words, w, -s, border);
+            else
+                value &= shiftedWord(pRow, words, w, s, border) & shiftedWord(pRow, words, w, -s, border);
+        }
+        pOutput[w] = value;
+    }
+    pOutput[words - 1] &= tail;
+}
+
+/*************/
+// Class for parallel threshold and morphology, each stripe of rows being done in a single pass
+// over the source. Rows around the stripe are processed as well, so that stripes are independent
+class Parallel_BinaryMorphology : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_BinaryMorphology(const cv::Mat* source, int threshold, int first, int second, bool close, int stripes,
+                                  BinaryMask* output, std::vector<unsigned long long>* counts):
+            _source(source), _threshold(threshold), _first(first), _second(second), _close(close), _stripes(stripes),
+            _output(output), _counts(counts) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const int rows = _source->rows;
+            const int cols = _source->cols;
+            const int words = _output->words();
+            const bool firstDilate = _close;
+            const bool secondDilate = !_close;
+
+            std::vector<uint64_t> packed(words), vertical(words);
+            for (int s = r.start; s < r.end; ++s)
+            {
+                const int y0 = rows * s / _stripes;
+                const int y1 = rows * (s + 1) / _stripes;
+
+                // Threshold, packing and first horizontal operation
+                const int a = std::max(0, y0 - _first - _second);
+                const int b = std::min(rows, y1 + _first + _second);
+                std::vector<uint64_t> firstPass((size_t)(b - a) * words);
+                for (int y = a; y < b; ++y)
+                {
+                    packRow(_source->ptr<uchar>(y), cols, _threshold, packed.data());
+                    morphologyRow(packed.data(), cols, _first, firstDilate, &firstPass[(size_t)(y - a) * words]);
+                }
+
+                // First vertical operation, and second horizontal one
+                const int a2 = std::max(0, y0 - _second);
+                const int b2 = std::min(rows, y1 + _second);
+                std::vector<uint64_t> secondPass((size_t)(b2 - a2) * words);
+                for (int y = a2; y < b2; ++y)
+                {
+                    verticalRow(firstPass, a, std::max(0, y - _first), std::min(rows, y + _first + 1), words, firstDilate, vertical.data());
+                    morphologyRow(vertical.data(), cols, _second, secondDilate, &secondPass[(size_t)(y - a2) * words]);
+                }
+
+                // Second vertical operation, directly to the output
+                unsigned long long count = 0;
+                for (int y = y0; y < y1; ++y)
+                {
+                    uint64_t* output = _output->row(y);
+                    verticalRow(secondPass, a2, std::max(0, y - _second), std::min(rows, y + _second + 1), words, secondDilate, output);
+                    for (int w = 0; w < words; ++w)
+                        count += __builtin_popcountll(output[w]);
+                }
+                (*_counts)[s] = count;
+            }
+        }
+
+    private:
+        const cv::Mat* _source;
+        int _threshold;
+        int _first, _second;
+        bool _close;
+        int _stripes;
+        BinaryMask* _output;
+        std::vector<unsigned long long>* _counts;
+
+        // Combines the rows [pStart, pEnd) of a buffer starting at row pOffset
+        static void verticalRow(const std::vector<uint64_t>& pBuffer, int pOffset, int pStart, int pEnd, int pWords, bool pDilate, uint64_t* pOutput)
+        {
+            const uint64_t* row = &pBuffer[(size_t)(pStart - pOffset) * pWords];
+            std::copy(row, row + pWords, pOutput);
+            for (int y = pStart + 1; y < pEnd; ++y)
+            {
+                row = &pBuffer[(size_t)(y - pOffset) * pWords];
+                if (pDilate)
+                    for (int w = 0; w < pWords; ++w)
+                        pOutput[w] |= row[w];
+                else
+                    for (int w = 0; w < pWords; ++w)
+                        pOutput[w] &= row[w];
+            }
+        }
+};
+
+/*************/
+// Class for parallel unpacking, row by row
+class Parallel_UnpackMask : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_UnpackMask(const BinaryMask* mask, cv::Mat* output):
+            _mask(mask), _output(output) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            for (int y = r.start; y < r.end; ++y)
+                unpackRow(_mask->row(y), _mask->cols(), _output->ptr<uchar>(y));
+        }
+
+    private:
+        const BinaryMask* _mask;
+        cv::Mat* _output;
+};
+
+/*************/
+// Converts a threshold given as a double to the equivalent integer one, for 8 bits values
+inline int binaryThreshold(double pThreshold)
+{
+    return std::max(-1, std::min(255, cvFloor(pThreshold)));
+}
+
+/*************/
+inline void BinaryMask::fromMat(const cv::Mat& pSource, double pThreshold)
+{
+    create(pSource.rows, pSource.cols);
+    const int threshold = binaryThreshold(pThreshold);
+    for (int y = 0; y < _rows; ++y)
+        packRow(pSource.ptr<uchar>(y), _cols, threshold, row(y));
+}
+
+/*************/
+inline void BinaryMask::toMat(cv::Mat& pOutput) const
+{
+    pOutput.create(_rows, _cols, CV_8U);
+    cv::parallel_for_(cv::Range(0, _rows), Parallel_UnpackMask(this, &pOutput));
+}
+
+/*************/
+// Thresholds a 8 bits single channel image (pixels strictly above pThreshold being set), then erodes it
+// pErode times and dilates it pDilate times with a 3x3 square, as cv::threshold, cv::erode and cv::dilate would.
+// If pClose is true, the dilation is done before the erosion.
+// Everything is done in a single pass over the source, and the number of set pixels is returned
+inline unsigned long long thresholdMorphology(const cv::Mat& pSource, double pThreshold, int pErode, int pDilate, BinaryMask& pOutput, bool pClose = false)
+{
+    if (pSource.total() == 0 || pSource.type() != CV_8U)
+    {
+        pOutput.create(0, 0);
+        return 0;
+    }
+
+    pOutput.create(pSource.rows, pSource.cols);
+
+    const int first = std::max(0, pClose ? pDilate : pErode);
+    const int second = std::max(0, pClose ? pErode : pDilate);
+
+    // Stripes are kept high enough for the rows processed around them to stay cheap
+    const int halo = first + second;
+    const int stripes = std::max(1, std::min(cv::getNumberOfCPUs(), pSource.rows / std::max(16, 4 * halo)));
+
+    std::vector<unsigned long long> counts(stripes, 0);
+    cv::parallel_for_(cv::Range(0, stripes), Parallel_BinaryMorphology(&pSource, binaryThreshold(pThreshold), first, second, pClose, stripes,
+                                                                       &pOutput, &counts));
+
+    unsigned long long count = 0;
+    for (auto c : counts)
+        count += c;
+    return count;
+}
+
+/*************/
+// Same as above, the result being unpacked to a CV_8U image holding 0 or 255
+inline unsigned long long thresholdMorphology(const cv::Mat& pSource, double pThreshold, int pErode, int pDilate, cv::Mat& pOutput, bool pClose = false)
+{
+    BinaryMask mask;
+    unsigned long long count = thresholdMorphology(pSource, pThreshold, pErode, pDilate, mask, pClose);
+    mask.toMat(pOutput);
+    return count;
+}
+
+#endif // BINARYMASK_H
@@ -27,8 +27,11 @@
 
 #include "capture.h"
 
+#include <mutex>
+
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
+#include <pcl/search/kdtree.h>
 
 /*************/
 class Capture_3D_PclRgba : public Capture
@@ -39,10 +42,28 @@ class Capture_3D_PclRgba : public Capture
 
         pcl::PointCloud<pcl::PointXYZRGBA>::Ptr get() {return mPcl;}
 
+        /**
+         * \brief Gets a spatial index over the cloud, built on the first call and then shared by all the users of this capture.
+         * Clouds coming from the sources are never organized, so a KdTree is used. The index must only be used for searches, not modified
+         */
+        pcl::search::Search<pcl::PointXYZRGBA>::Ptr getSearch()
+        {
+            std::lock_guard<std::mutex> lock(mSearchMutex);
+            if (mSearch.get() == NULL && mPcl.get() != NULL && mPcl->size() != 0)
+            {
+                mSearch.reset(new pcl::search::KdTree<pcl::PointXYZRGBA>());
+                mSearch->setInputCloud(mPcl);
+            }
+            return mSearch;
+        }
+
         std::string type() {return std::string("Capture_3D_Pcl");}
 
     private:
         pcl::PointCloud<pcl::PointXYZRGBA>::Ptr mPcl;
+
+        std::mutex mSearchMutex;
+        pcl::search::Search<pcl::PointXYZRGBA>::Ptr mSearch;
 };
 
 typedef std::shared_ptr<Capture_3D_PclRgba> Capture_3D_PclRgba_Ptr;
@@ -28,6 +28,8 @@
 #ifndef DESCRIPTOR_HOG_H
 #define DESCRIPTOR_HOG_H
 
+#include <vector>
+
 #include <opencv2/opencv.hpp>
 
 #include "config.h"
@@ -36,6 +38,8 @@
 //! Class designed to output a HOG descriptor for a given input image
 class Descriptor_Hog
 {
+    friend class Parallel_CellHistograms;
+
     public:
         enum Hog_Norm {
             L1_NORM = 0,
@@ -115,13 +119,39 @@ class Descriptor_Hog
 
         // Constant attributes
         float _epsilon; // A small value, used for normalization.
-        cv::Mat _kernelH, _kernelV;
+
+        // Binning of the gradient orientations, for each of the 256 possible values.
+        // A gradient is shared between its bin and the nearest neighbour bin
+        std::vector<int> _binIndex, _binNeighbour;
+        std::vector<float> _binNeighbourWeight;
+        // Gaussian weights applied over the cells of a block
+        std::vector<float> _blockWeights;
+
+        // Normalized cell histograms computed once per image, on a grid aligned with the image
+        // There is a grid for each cell size, and descriptors at aligned positions only gather them
+        struct CellGrid
+        {
+            cv::Size_<int> cellSize;
+            int cols, rows;
+            std::vector<float> histograms;
+        };
+        std::vector<CellGrid> _cellGrids;
 
         // Computes a single scale descriptor
         std::vector<float> getSingleScaleDescriptor(cv::Point_<int> pPos, const cv::Size_<int> pCellSize) const;
 
         // Method to compute the norm of a descriptor
         float getDescriptorNorm(std::vector<float> pDescriptor) const;
+        float getDescriptorNorm(const float* pDescriptor) const;
+
+        // Updates the lookup tables, when the parameters change
+        void updateBinning();
+        void updateBlockWeights();
+
+        // Returns all the cell sizes used to build a descriptor
+        std::vector< cv::Size_<int> > getCellSizes() const;
+        // Computes the normalized histogram of the cell at the given position
+        void getCellHistogram(cv::Point_<int> pTopLeft, const cv::Size_<int> pCellSize, float* pHistogram) const;
 
         // Centered normal distribution
         float getGaussian(const float x, const float sigma) const;
@@ -0,0 +1,117 @@
+/*
+ * Copyright (C) 2013 Emmanuel Durand
+ *
+ * This file is part of blobserver.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @framewriter.h
+ * FrameWriter, a class to write images to disk asynchronously.
+ */
+
+#ifndef FRAMEWRITER_H
+#define FRAMEWRITER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/*************/
+//! Writes frames to disk from a bounded queue, using a set of encoder threads
+class FrameWriter
+{
+    public:
+        //! What to do when a frame is submitted while the queue is full
+        enum DropPolicy
+        {
+            dropNewest = 0, //!< The submitted frame is dropped
+            dropOldest //!< The oldest queued frame is dropped to make room
+        };
+
+        /**
+         * \brief Constructor
+         * \param pThreads Number of encoder threads
+         * \param pQueueSize Maximum number of frames waiting to be written
+         */
+        FrameWriter(unsigned int pThreads = 2, unsigned int pQueueSize = 16);
+
+        /**
+         * \brief Destructor. Frames still in the queue are written before returning
+         */
+        ~FrameWriter();
+
+        /**
+         * \brief Queues a frame to be written
+         * \param pFrame Frame to write. It is copied if accepted in the queue
+         * \param pBasename File path, without extension
+         * \return Returns false if a frame has been dropped
+         */
+        bool write(const cv::Mat& pFrame, const std::string& pBasename);
+
+        /**
+         * \brief Sets the output format
+         * \param pExtension File extension, which determines the format (png, jpg, ppm, ...)
+         * \param pCompression PNG compression level (0-9) or JPEG quality (0-100). Negative for the default
+         */
+        void setFormat(const std::string& pExtension, int pCompression = -1);
+
+        /**
+         * \brief Sets the policy applied when the queue is full
+         */
+        void setDropPolicy(DropPolicy pPolicy) {mDropPolicy = pPolicy;}
+
+        /**
+         * \brief Gets the number of frames dropped since creation
+         */
+        unsigned long long getDropped() const {return mDropped;}
+
+        /**
+         * \brief Gets the number of frames written since creation
+         */
+        unsigned long long getWritten() const {return mWritten;}
+
+    private:
+        struct Job
+        {
+            cv::Mat frame;
+            std::string filename;
+            std::vector<int> params;
+        };
+
+        std::vector<std::thread> mThreads;
+        std::deque<Job> mQueue;
+        unsigned int mQueueSize;
+        std::mutex mMutex;
+        std::condition_variable mCondition;
+        bool mStop;
+
+        std::string mExtension;
+        std::vector<int> mParams;
+        std::atomic_int mDropPolicy;
+
+        std::atomic_ullong mDropped;
+        std::atomic_ullong mWritten;
+
+        void encode();
+};
+
+#endif // FRAMEWRITER_H
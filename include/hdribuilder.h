@@ -25,6 +25,8 @@
 #ifndef HDRIBUILDER_H
 #define HDRIBUILDER_H
 
+#include <vector>
+
 #include <opencv2/opencv.hpp>
 
 /*************/
@@ -32,8 +34,7 @@ struct LDRi
 {
     cv::Mat image;
     float EV;
-    cv::Mat imagef;
-    cv::Mat w;
+    std::vector<float> valueLUT; // Weighted, exposure corrected value for each 8u input
 };
 
 /*************/
@@ -47,6 +48,8 @@ class HdriBuilder
 
         // Adds an LDR image to the list
         // LDRi must be of type RGB8u
+        // In continuous mode, an LDRi with the same EV as a previous one
+        // replaces it, and the HDRI is updated incrementally
         bool addLDR(const cv::Mat& pImage, float pEV);
 
         // Retrieves the HDRI
@@ -63,27 +66,33 @@ class HdriBuilder
         // If mContinous is set to true, LDRi list is never cleared
         bool mContinuous;
 
-        // LDR images list
+        // LDR images list, sorted by EV
         std::vector<LDRi> mLDRi;
 
         // Computed HDRi
         cv::Mat mHDRi;
-    
-        // Minimum sum used in the HDRi computation
-        float mMinSum;
-    
-        // Images with highest and lowest exposures
-        unsigned int mMinExposureIndex;
-        unsigned int mMaxExposureIndex;
+
+        // Running sums of the contributions of all LDRi, and of their weights
+        // They are kept in double precision, as replacing an LDRi subtracts its contribution
+        cv::Mat mValueSum;
+        cv::Mat mWeightSum;
+        // Number of incremental updates since the sums were last recomputed
+        unsigned int mUpdateCount;
 
         // LUT to convert between LDR value to a gaussian coeff
-        std::map<uchar, float> mGaussianLUT;
+        float mGaussianLUT[256];
     
         /****************/
         // Methods
         // Returns the coefficient to apply to a 8u value
         // according to a gaussian curve centered on 127
         float getGaussian(unsigned char pValue) const;
+
+        // Adds (pSign = 1) or removes (pSign = -1) the contribution of an LDRi
+        void accumulate(const LDRi& pLDRi, float pSign);
+
+        // Recomputes the running sums from all LDRi
+        void resetSums();
 };
 
 #endif // HDRIBUILDER_H
@@ -25,39 +25,693 @@
 #ifndef HELPERS_H
 #define HELPERS_H
 
+#include <algorithm>
+#include <climits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+#include <vector>
+
 #include "opencv2/opencv.hpp"
 #include "atom/message.h"
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "binarymask.h"
 #include "blob.h"
 
 /*************/
-// Class for parallel masking
-template <typename PixType>
+// Masking kernels
+// Masks hold one byte per byte of the buffer they apply to, either 0x00 or
+// 0xFF, so that a single bitwise operation handles any pixel layout
+/*************/
+// dst = src & mask
+inline void maskBytes(const uchar* src, const uchar* mask, uchar* dst, size_t length)
+{
+    size_t i = 0;
+#if CV_SSE2
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i s = _mm_loadu_si128((const __m128i*)(src + i));
+        __m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_and_si128(s, m));
+    }
+#endif
+    for (; i < length; ++i)
+        dst[i] = src[i] & mask[i];
+}
+
+/*************/
+// dst = mask ? first : second
+inline void selectBytes(const uchar* first, const uchar* second, const uchar* mask, uchar* dst, size_t length)
+{
+    size_t i = 0;
+#if CV_SSE2
+    for (; i + 16 <= length; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(first + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(second + i));
+        __m128i m = _mm_loadu_si128((const __m128i*)(mask + i));
+        _mm_storeu_si128((__m128i*)(dst + i), _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b)));
+    }
+#endif
+    for (; i < length; ++i)
+        dst[i] = (first[i] & mask[i]) | (second[i] & ~mask[i]);
+}
+
+/*************/
+// Class for parallel masking, row by row
 class Parallel_Mask : public cv::ParallelLoopBody
 {
     public:
-        Parallel_Mask(cv::Mat* buffer, cv::Mat* mask):
-            _buffer(buffer), _mask(mask) {}
+        Parallel_Mask(const cv::Mat* buffer, const cv::Mat* mask, cv::Mat* output):
+            _buffer(buffer), _mask(mask), _output(output) {}
 
         void operator()(const cv::Range& r) const
         {
-            PixType* buffer = &(_buffer->at<PixType>(r.start, 0));
-            PixType* mask = &(_mask->at<uchar>(r.start, 0));
-            for (int y = r.start; y != r.end; ++y, buffer += _buffer->cols*sizeof(PixType), mask += _mask->cols*sizeof(uchar))
+            size_t length = _buffer->cols * _buffer->elemSize();
+            for (int y = r.start; y < r.end; ++y)
+                maskBytes(_buffer->ptr<uchar>(y), _mask->ptr<uchar>(y), _output->ptr<uchar>(y), length);
+        }
+
+    private:
+        const cv::Mat* _buffer;
+        const cv::Mat* _mask;
+        cv::Mat* _output;
+};
+
+/*************/
+// Class for parallel masking of continuous buffers, by chunks of bytes
+class Parallel_MaskContinuous : public cv::ParallelLoopBody
+{
+    public:
+        static const size_t chunkSize = 1 << 16;
+
+        Parallel_MaskContinuous(const uchar* buffer, const uchar* mask, uchar* output, size_t length):
+            _buffer(buffer), _mask(mask), _output(output), _length(length) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            for (int i = r.start; i < r.end; ++i)
             {
-                for (int x = 0; x < _buffer->cols; ++x)
+                size_t start = i * chunkSize;
+                size_t length = _length - start < chunkSize ? _length - start : chunkSize;
+                maskBytes(_buffer + start, _mask + start, _output + start, length);
+            }
+        }
+
+    private:
+        const uchar* _buffer;
+        const uchar* _mask;
+        uchar* _output;
+        size_t _length;
+};
+
+/*************/
+// Class for parallel selection between two buffers, row by row
+class Parallel_Select : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Select(const cv::Mat* first, const cv::Mat* second, const cv::Mat* mask, cv::Mat* output):
+            _first(first), _second(second), _mask(mask), _output(output) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            size_t length = _first->cols * _first->elemSize();
+            for (int y = r.start; y < r.end; ++y)
+                selectBytes(_first->ptr<uchar>(y), _second->ptr<uchar>(y), _mask->ptr<uchar>(y), _output->ptr<uchar>(y), length);
+        }
+
+    private:
+        const cv::Mat* _first;
+        const cv::Mat* _second;
+        const cv::Mat* _mask;
+        cv::Mat* _output;
+};
+
+/*************/
+// Applies an expanded mask (same size and element size as the buffer) to
+// pBuffer. pOutput can be pBuffer itself.
+inline bool maskImage(const cv::Mat& pBuffer, const cv::Mat& pMask, cv::Mat& pOutput)
+{
+    if (pBuffer.size() != pMask.size() || pBuffer.elemSize() != pMask.elemSize())
+        return false;
+
+    if (pOutput.data != pBuffer.data)
+        pOutput.create(pBuffer.size(), pBuffer.type());
+
+    // Continuous buffers are handled as a single long row
+    if (pBuffer.isContinuous() && pMask.isContinuous() && pOutput.isContinuous())
+    {
+        const size_t length = pBuffer.total() * pBuffer.elemSize();
+        const size_t chunk = Parallel_MaskContinuous::chunkSize;
+        cv::parallel_for_(cv::Range(0, (length + chunk - 1) / chunk),
+                          Parallel_MaskContinuous(pBuffer.data, pMask.data, pOutput.data, length));
+    }
+    else
+    {
+        cv::parallel_for_(cv::Range(0, pBuffer.rows), Parallel_Mask(&pBuffer, &pMask, &pOutput));
+    }
+
+    return true;
+}
+
+/*************/
+// Selects pixels from pFirst where pMask is set, and from pSecond elsewhere
+inline bool selectImage(const cv::Mat& pFirst, const cv::Mat& pSecond, const cv::Mat& pMask, cv::Mat& pOutput)
+{
+    if (pFirst.size() != pSecond.size() || pFirst.type() != pSecond.type()
+        || pFirst.size() != pMask.size() || pFirst.elemSize() != pMask.elemSize())
+        return false;
+
+    if (pOutput.data != pFirst.data && pOutput.data != pSecond.data)
+        pOutput.create(pFirst.size(), pFirst.type());
+
+    cv::parallel_for_(cv::Range(0, pFirst.rows), Parallel_Select(&pFirst, &pSecond, &pMask, &pOutput));
+    return true;
+}
+
+/*************/
+// Mask holder, keeping a pre-expanded version of the mask
+// for each resolution and pixel size it has been asked for
+class MaskCache
+{
+    public:
+        MaskCache() {}
+
+        /**
+         * Sets the source mask. Any non-zero pixel is kept when masking.
+         * An empty matrix disables the mask.
+         */
+        void set(const cv::Mat& pMask)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _cache.clear();
+            _source = cv::Mat();
+
+            if (pMask.total() == 0)
+                return;
+
+            cv::Mat gray = pMask;
+            if (pMask.channels() > 1)
+            {
+                std::vector<cv::Mat> channels;
+                cv::split(pMask, channels);
+                gray = channels[0];
+                for (int i = 1; i < channels.size(); ++i)
+                    cv::max(gray, channels[i], gray);
+            }
+            cv::compare(gray, 0, _source, cv::CMP_NE);
+        }
+
+        bool isSet() const
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            return _source.total() != 0;
+        }
+
+        /**
+         * Gets the mask resized to pSize and expanded to pElemSize bytes per pixel
+         * Returns an empty matrix if no mask is set
+         */
+        cv::Mat get(cv::Size pSize, int pElemSize = 1, int pInterpolation = cv::INTER_NEAREST)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_source.total() == 0)
+                return cv::Mat();
+
+            auto key = std::make_tuple(pSize.width, pSize.height, pElemSize, pInterpolation);
+            auto cached = _cache.find(key);
+            if (cached != _cache.end())
+                return cached->second;
+
+            cv::Mat resized = _source;
+            if (pSize != _source.size())
+            {
+                cv::resize(_source, resized, pSize, 0, 0, pInterpolation);
+                if (pInterpolation != cv::INTER_NEAREST)
+                    cv::compare(resized, 0, resized, cv::CMP_NE);
+            }
+
+            cv::Mat expanded = resized;
+            if (pElemSize > 1)
+            {
+                std::vector<cv::Mat> planes(pElemSize, resized);
+                cv::merge(planes, expanded);
+            }
+
+            // Resolutions rarely change, but we don't want this to grow unbounded
+            if (_cache.size() >= 8)
+                _cache.clear();
+            _cache[key] = expanded;
+
+            return expanded;
+        }
+
+        /**
+         * Masks pImg in place. Does nothing if no mask is set.
+         */
+        void apply(cv::Mat& pImg)
+        {
+            if (pImg.total() == 0)
+                return;
+
+            cv::Mat mask = get(pImg.size(), pImg.elemSize());
+            if (mask.total() != 0)
+                maskImage(pImg, mask, pImg);
+        }
+
+    private:
+        mutable std::mutex _mutex;
+        cv::Mat _source;
+        std::map<std::tuple<int, int, int, int>, cv::Mat> _cache;
+};
+
+/*************/
+// Connected components
+// Components are extracted from runs of foreground pixels: horizontal stripes
+// of the mask are processed in parallel, then joined at their borders
+/*************/
+// Properties of a connected component of a binary mask
+struct Component
+{
+    int label; //!< Label of the component in the label image, starting from 1
+    int area; //!< Number of pixels
+    cv::Rect box; //!< Bounding box
+    cv::Point2f centroid;
+    float mu20, mu11, mu02; //!< Central second order moments, divided by the area
+    std::vector<cv::Point> contour; //!< External contour, only filled if asked for
+};
+
+/*************/
+// Horizontal run of foreground pixels, end excluded
+struct ComponentRun
+{
+    int y, start, end;
+};
+
+/*************/
+inline int findComponentRoot(std::vector<int>& pParents, int pIndex)
+{
+    while (pParents[pIndex] != pIndex)
+    {
+        pParents[pIndex] = pParents[pParents[pIndex]];
+        pIndex = pParents[pIndex];
+    }
+    return pIndex;
+}
+
+/*************/
+// Joins the runs of two consecutive rows which touch each other
+// The root of a set is always its first run, so that labels follow the raster order
+inline void joinComponentRuns(const std::vector<ComponentRun>& pRuns, std::vector<int>& pParents, size_t pPrevStart, size_t pPrevEnd,
+                              size_t pCurStart, size_t pCurEnd, int pDiagonal)
+{
+    size_t prev = pPrevStart;
+    for (size_t cur = pCurStart; cur < pCurEnd; ++cur)
+    {
+        while (prev < pPrevEnd && pRuns[prev].end + pDiagonal <= pRuns[cur].start)
+            prev++;
+        for (size_t p = prev; p < pPrevEnd && pRuns[p].start < pRuns[cur].end + pDiagonal; ++p)
+        {
+            int first = findComponentRoot(pParents, p);
+            int second = findComponentRoot(pParents, cur);
+            if (first < second)
+                pParents[second] = first;
+            else if (second < first)
+                pParents[first] = second;
+        }
+    }
+}
+
+/*************/
+// Appends the runs of a row of 8 bits pixels, any non-zero pixel being foreground
+inline void extractRowRuns(const uchar* pRow, int pCols, int pY, std::vector<ComponentRun>& pRuns)
+{
+    int x = 0;
+    while (x < pCols)
+    {
+#if CV_SSE2
+        // Empty areas are skipped 16 pixels at a time
+        const __m128i zero = _mm_setzero_si128();
+        while (x + 16 <= pCols
+               && _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(pRow + x)), zero)) == 0xFFFF)
+            x += 16;
+#endif
+        while (x < pCols && pRow[x] == 0)
+            x++;
+        if (x == pCols)
+            break;
+
+        ComponentRun run;
+        run.y = pY;
+        run.start = x;
+        while (x < pCols && pRow[x] != 0)
+            x++;
+        run.end = x;
+        pRuns.push_back(run);
+    }
+}
+
+/*************/
+// Appends the runs of a packed row. Run borders are found with a bit scan on each word,
+// so that empty or full words are skipped at once
+inline void extractRowRuns(const uint64_t* pRow, int pWords, int pY, std::vector<ComponentRun>& pRuns)
+{
+    ComponentRun run;
+    run.y = pY;
+    bool inRun = false;
+    for (int w = 0; w < pWords; ++w)
+    {
+        const uint64_t word = pRow[w];
+        uint64_t remaining = ~0ull; // Bits of the word not looked at yet
+        while (remaining != 0)
+        {
+            // The next border is the next unset bit inside a run, or the next set bit outside
+            uint64_t borders = (inRun ? ~word : word) & remaining;
+            if (borders == 0)
+                break;
+
+            int bit = __builtin_ctzll(borders);
+            if (inRun)
+            {
+                run.end = w * 64 + bit;
+                pRuns.push_back(run);
+            }
+            else
+            {
+                run.start = w * 64 + bit;
+            }
+            inRun = !inRun;
+            remaining = bit == 63 ? 0ull : ~0ull << (bit + 1);
+        }
+    }
+
+    // Bits past the last column are never set, so only a row ending on a full word can end inside a run
+    if (inRun)
+    {
+        run.end = pWords * 64;
+        pRuns.push_back(run);
+    }
+}
+
+/*************/
+// Runs of one horizontal stripe of the mask, joined inside the stripe
+struct ComponentStripe
+{
+    int rowStart, rowEnd;
+    std::vector<ComponentRun> runs;
+    std::vector<int> parents;
+    size_t firstRowEnd; //!< Runs of the first row are [0, firstRowEnd)
+    size_t lastRowStart; //!< Runs of the last row are [lastRowStart, runs.size())
+};
+
+/*************/
+// Class for parallel extraction of the runs, one stripe at a time
+// The mask is either a 8 bits image or a BinaryMask, the other one being NULL
+class Parallel_ComponentRuns : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_ComponentRuns(const cv::Mat* mask, const BinaryMask* bits, std::vector<ComponentStripe>* stripes, int diagonal):
+            _mask(mask), _bits(bits), _stripes(stripes), _diagonal(diagonal) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            for (int s = r.start; s < r.end; ++s)
+            {
+                ComponentStripe& stripe = (*_stripes)[s];
+                stripe.runs.clear();
+                stripe.parents.clear();
+                stripe.firstRowEnd = 0;
+                stripe.lastRowStart = 0;
+
+                size_t prevStart = 0, prevEnd = 0;
+                for (int y = stripe.rowStart; y < stripe.rowEnd; ++y)
+                {
+                    size_t curStart = stripe.runs.size();
+                    if (_bits != NULL)
+                        extractRowRuns(_bits->row(y), _bits->words(), y, stripe.runs);
+                    else
+                        extractRowRuns(_mask->ptr<uchar>(y), _mask->cols, y, stripe.runs);
+                    size_t curEnd = stripe.runs.size();
+                    for (size_t i = curStart; i < curEnd; ++i)
+                        stripe.parents.push_back(i);
+
+                    if (y > stripe.rowStart)
+                        joinComponentRuns(stripe.runs, stripe.parents, prevStart, prevEnd, curStart, curEnd, _diagonal);
+                    else
+                        stripe.firstRowEnd = curEnd;
+
+                    prevStart = curStart;
+                    prevEnd = curEnd;
+                }
+                stripe.lastRowStart = prevStart;
+            }
+        }
+
+    private:
+        const cv::Mat* _mask;
+        const BinaryMask* _bits;
+        std::vector<ComponentStripe>* _stripes;
+        int _diagonal;
+};
+
+/*************/
+// Class for parallel accumulation of the component properties, and writing of the labels
+class Parallel_ComponentStats : public cv::ParallelLoopBody
+{
+    public:
+        struct Accumulator
+        {
+            long long area;
+            int minX, minY, maxX, maxY;
+            double sumX, sumY, sumXX, sumXY, sumYY;
+        };
+
+        Parallel_ComponentStats(const std::vector<ComponentStripe>* stripes, const std::vector<size_t>* offsets, const std::vector<int>* runLabels,
+                                int labelNbr, std::vector<Accumulator>* accumulators, cv::Mat* labels):
+            _stripes(stripes), _offsets(offsets), _runLabels(runLabels), _labelNbr(labelNbr), _accumulators(accumulators), _labels(labels)
+        {
+            _mutex.reset(new std::mutex());
+        }
+
+        void operator()(const cv::Range& r) const
+        {
+            Accumulator empty = {0, INT_MAX, INT_MAX, INT_MIN, INT_MIN, 0.0, 0.0, 0.0, 0.0, 0.0};
+            std::vector<Accumulator> accumulators(_labelNbr, empty);
+
+            for (int s = r.start; s < r.end; ++s)
+            {
+                const ComponentStripe& stripe = (*_stripes)[s];
+                if (_labels != NULL)
+                    _labels->rowRange(stripe.rowStart, stripe.rowEnd).setTo(0);
+
+                for (size_t i = 0; i < stripe.runs.size(); ++i)
                 {
-                    if (*(mask + x*sizeof(uchar)) == 0)
-                        *(buffer + x*sizeof(PixType)) = PixType(0);
+                    const ComponentRun& run = stripe.runs[i];
+                    int label = (*_runLabels)[(*_offsets)[s] + i];
+                    Accumulator& acc = accumulators[label - 1];
+
+                    // Sums over the run are computed in closed form
+                    double n = run.end - run.start;
+                    double first = run.start, last = run.end - 1;
+                    double sumX = n * (first + last) / 2.0;
+                    double sumXX = (last * (last + 1.0) * (2.0 * last + 1.0) - (first - 1.0) * first * (2.0 * first - 1.0)) / 6.0;
+                    acc.area += run.end - run.start;
+                    acc.minX = std::min(acc.minX, run.start);
+                    acc.maxX = std::max(acc.maxX, run.end - 1);
+                    acc.minY = std::min(acc.minY, run.y);
+                    acc.maxY = std::max(acc.maxY, run.y);
+                    acc.sumX += sumX;
+                    acc.sumY += n * run.y;
+                    acc.sumXX += sumXX;
+                    acc.sumXY += sumX * run.y;
+                    acc.sumYY += n * run.y * run.y;
+
+                    if (_labels != NULL)
+                    {
+                        int* row = _labels->ptr<int>(run.y);
+                        for (int x = run.start; x < run.end; ++x)
+                            row[x] = label;
+                    }
                 }
             }
+
+            std::lock_guard<std::mutex> lock(*_mutex.get());
+            for (int l = 0; l < _labelNbr; ++l)
+            {
+                const Accumulator& acc = accumulators[l];
+                if (acc.area == 0)
+                    continue;
+                Accumulator& global = (*_accumulators)[l];
+                global.area += acc.area;
+                global.minX = std::min(global.minX, acc.minX);
+                global.minY = std::min(global.minY, acc.minY);
+                global.maxX = std::max(global.maxX, acc.maxX);
+                global.maxY = std::max(global.maxY, acc.maxY);
+                global.sumX += acc.sumX;
+                global.sumY += acc.sumY;
+                global.sumXX += acc.sumXX;
+                global.sumXY += acc.sumXY;
+                global.sumYY += acc.sumYY;
+            }
+        }
+
+    private:
+        const std::vector<ComponentStripe>* _stripes;
+        const std::vector<size_t>* _offsets;
+        const std::vector<int>* _runLabels;
+        int _labelNbr;
+        std::vector<Accumulator>* _accumulators;
+        cv::Mat* _labels;
+        std::shared_ptr<std::mutex> _mutex;
+};
+
+/*************/
+// Class for parallel extraction of the contours of the components
+class Parallel_ComponentContours : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_ComponentContours(const cv::Mat* labels, std::vector<Component>* components):
+            _labels(labels), _components(components) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            for (int i = r.start; i < r.end; ++i)
+            {
+                Component& component = (*_components)[i];
+                // findContours clears the one pixel border of its input, so the crop is padded
+                // to keep the whole component, whatever its size and position
+                cv::Mat mask;
+                cv::copyMakeBorder((*_labels)(component.box) == component.label, mask, 1, 1, 1, 1, cv::BORDER_CONSTANT, cv::Scalar(0));
+
+                std::vector< std::vector<cv::Point> > contours;
+                cv::findContours(mask, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE, component.box.tl() - cv::Point(1, 1));
+
+                // A component has a single external contour, but we never know
+                size_t best = 0;
+                for (size_t c = 1; c < contours.size(); ++c)
+                    if (contours[c].size() > contours[best].size())
+                        best = c;
+                if (contours.size() > 0)
+                    component.contour = contours[best];
+            }
         }
 
     private:
-        cv::Mat* _buffer;
-        cv::Mat* _mask;
+        const cv::Mat* _labels;
+        std::vector<Component>* _components;
 };
 
+/*************/
+// Extracts the connected components of a pRows x pCols mask, given either as a 8 bits image or as a BinaryMask
+inline std::vector<Component> extractMaskComponents(int pRows, int pCols, const cv::Mat* pMask, const BinaryMask* pBits,
+                                                    cv::Mat* pLabels, bool pContours, bool pEightConnected)
+{
+    std::vector<Component> components;
+    const int diagonal = pEightConnected ? 1 : 0;
+
+    // Runs are extracted and joined per stripe
+    int stripeNbr = std::max(1, std::min(pRows, cv::getNumberOfCPUs()));
+    std::vector<ComponentStripe> stripes(stripeNbr);
+    for (int s = 0; s < stripeNbr; ++s)
+    {
+        stripes[s].rowStart = pRows * s / stripeNbr;
+        stripes[s].rowEnd = pRows * (s + 1) / stripeNbr;
+    }
+    cv::parallel_for_(cv::Range(0, stripeNbr), Parallel_ComponentRuns(pMask, pBits, &stripes, diagonal));
+
+    // Then all stripes are joined together
+    std::vector<size_t> offsets(stripeNbr, 0);
+    std::vector<ComponentRun> runs;
+    std::vector<int> parents;
+    for (int s = 0; s < stripeNbr; ++s)
+    {
+        offsets[s] = runs.size();
+        runs.insert(runs.end(), stripes[s].runs.begin(), stripes[s].runs.end());
+        for (auto parent : stripes[s].parents)
+            parents.push_back(parent + offsets[s]);
+    }
+    for (int s = 1; s < stripeNbr; ++s)
+    {
+        if (stripes[s - 1].rowEnd == stripes[s - 1].rowStart || stripes[s].rowEnd == stripes[s].rowStart)
+            continue;
+        joinComponentRuns(runs, parents, offsets[s - 1] + stripes[s - 1].lastRowStart, offsets[s - 1] + stripes[s - 1].runs.size(),
+                          offsets[s], offsets[s] + stripes[s].firstRowEnd, diagonal);
+    }
+
+    // Labels are given in the order of the roots
+    std::vector<int> runLabels(runs.size(), 0);
+    int labelNbr = 0;
+    for (size_t i = 0; i < runs.size(); ++i)
+    {
+        int root = findComponentRoot(parents, i);
+        if (root == (int)i)
+            runLabels[i] = ++labelNbr;
+        else
+            runLabels[i] = runLabels[root];
+    }
+
+    // Properties are accumulated per stripe, and the labels are written at the same time
+    cv::Mat labels;
+    cv::Mat* labelsPtr = pLabels;
+    if (pContours && labelsPtr == NULL)
+        labelsPtr = &labels;
+    if (labelsPtr != NULL)
+        labelsPtr->create(pRows, pCols, CV_32S);
+
+    Parallel_ComponentStats::Accumulator empty = {0, INT_MAX, INT_MAX, INT_MIN, INT_MIN, 0.0, 0.0, 0.0, 0.0, 0.0};
+    std::vector<Parallel_ComponentStats::Accumulator> accumulators(labelNbr, empty);
+    cv::parallel_for_(cv::Range(0, stripeNbr), Parallel_ComponentStats(&stripes, &offsets, &runLabels, labelNbr, &accumulators, labelsPtr));
+
+    components.resize(labelNbr);
+    for (int l = 0; l < labelNbr; ++l)
+    {
+        const Parallel_ComponentStats::Accumulator& acc = accumulators[l];
+        Component& component = components[l];
+        double area = (double)acc.area;
+        double cx = acc.sumX / area;
+        double cy = acc.sumY / area;
+
+        component.label = l + 1;
+        component.area = (int)acc.area;
+        component.box = cv::Rect(acc.minX, acc.minY, acc.maxX - acc.minX + 1, acc.maxY - acc.minY + 1);
+        component.centroid = cv::Point2f(cx, cy);
+        component.mu20 = acc.sumXX / area - cx * cx;
+        component.mu11 = acc.sumXY / area - cx * cy;
+        component.mu02 = acc.sumYY / area - cy * cy;
+    }
+
+    if (pContours)
+        cv::parallel_for_(cv::Range(0, labelNbr), Parallel_ComponentContours(labelsPtr, &components));
+
+    return components;
+}
+
+/*************/
+// Extracts the connected components of a 8 bits mask, where any non-zero pixel is foreground
+// Components are ordered by their first pixel, in raster order
+// If pLabels is not null, it receives the CV_32S label image, 0 being the background
+// Contours are only extracted if pContours is true
+inline std::vector<Component> extractComponents(const cv::Mat& pMask, cv::Mat* pLabels = NULL, bool pContours = false, bool pEightConnected = true)
+{
+    if (pMask.total() == 0 || pMask.type() != CV_8U)
+        return std::vector<Component>();
+    return extractMaskComponents(pMask.rows, pMask.cols, &pMask, NULL, pLabels, pContours, pEightConnected);
+}
+
+/*************/
+// Same as above, the runs being read directly from the packed words of a BinaryMask
+inline std::vector<Component> extractComponents(const BinaryMask& pMask, cv::Mat* pLabels = NULL, bool pContours = false, bool pEightConnected = true)
+{
+    if (pMask.total() == 0)
+        return std::vector<Component>();
+    return extractMaskComponents(pMask.rows(), pMask.cols(), NULL, &pMask, pLabels, pContours, pEightConnected);
+}
+
 /*************/
 // Function to read a value from a message
 template<class T>
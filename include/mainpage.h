@@ -51,12 +51,24 @@
  * - rotation (float): apply rotation on the image, in degrees
  * - scaleValue (float): multiply all channels by this coefficient
  * - noiseFiltering (int, default 0): set to 1 to activate noise filtering
+ * - temporalFiltering (float[2]): recursive temporal noise filtering, for 8 bits images. Parameters are: [weight of the new frame, in ]0, 1[] [motion threshold, in pixel value]. Pixels differing from the average by more than the threshold are not averaged, to prevent ghosting. A weight of 0 or 1 deactivates it
  * - distortion (int[3]): distortion correction (see http://wiki.panotools.org/Lens_correction_model). Parameters are: [a] [b] [c]
  * - fisheye (float[2]): fisheye correction (see http://wiki.panotools.org/Fisheye_Projection). Parameters are, in pixels: [fisheyeFocal] [rectilinearFocal] 
  * - vignetting (int[3]): correction of the vignetting (see http://lensfun.berlios.de/lens-calibration/lens-vignetting.html). Parameters are: [k1] [k2] [k3]
  * - iccInputProfile (string): file path to an ICC profile (for color correction)
  * - hdri (int[5]): activates the creation of a HDR image. Parameters are: [startExposure] [stepSize] [nbrSteps] [frameSkip] [continuousHDRActive].
+ * - tonemapping (int int float float): converts float (HDR) images to 8 bits. Parameters are: [activation] [operator: 0 for gamma, 1 for Reinhard] [percentile used as white, default 100] [gamma, default 2.2]
  * - save (int[2] string): activates the automatic save of grabs. Parameters are: [activation] [period] [filename] 
+ * - saveFormat (string int): format of the saved grabs. Parameters are: [extension, default png] [compression level, 0-9 for png, quality 0-100 for jpg]
+ * - saveQueue (int[3]): saved grabs are encoded asynchronously. Parameters are: [number of encoder threads, default 2] [maximum queued frames, default 16] [drop policy when full: 0 to drop the new frame, 1 to drop the oldest]
+ * - record (string): file path where the raw frames and their capture time are recorded, to be replayed with Source_2D_Recording. An empty path stops the recording
+ * - correctionOrder (string[n]): order in which the corrections are applied, by parameter name. Corrections not listed keep their relative order after the listed ones. Default order is: autoExposure mask noiseFiltering temporalFiltering vignetting iccInputProfile gammaCorrection distortion fisheye scale rotation crop scaleValues hdri tonemapping
+ * - correctionEnabled (string int): set to 0 to disable the given correction without losing its configuration, 1 to enable it back
+ *
+ * The following read-only parameters are also available:
+ * - correctionStages: for each correction, in order: [name] [enabled] [active] [mean time per frame, in ms]
+ * - saveDropped: number of grabs which could not be saved because the queue was full
+ * - recordedFrames: number of frames in the current recording
  * 
  * \subsection source_2d_opencv_sec OpenCV 2D sources (Source_2D_OpenCV)
  * 
@@ -72,6 +84,12 @@
  * - whiteBalanceRed (int): coefficient applied to the red channel, multiplied by a value dependent of the camera model
  * - whiteBalanceBlue (int): coefficient applied to the blue channel, multiplied by a value dependent of the camera model
  * - iso (int): link speed to set for firewire cameras
+ * - url (string): file or stream to read from, instead of a camera. It is decoded in its own thread
+ * - playback (int, default 0): for files and streams, 0 follows the frame timestamps and only outputs the newest decoded frame, 1 outputs every frame
+ * - queueSize (int, default 4): maximum number of decoded frames waiting to be output
+ *
+ * The following read-only parameter is also available:
+ * - dropped: number of decoded frames which have not been output
  * 
  * \subsection source_2d_gige_sec Gigabit ethernet cameras (Source_2D_Gige)
  *
@@ -92,10 +110,27 @@
  *
  * \subsection source_2d_image_sec Image 2D sources (Source_2D_Image)
  * 
- * A source which loads a single image specified by its URL. Useful for masks.
+ * A source which loads a single image specified by its URL, useful for masks, or a sequence of images. Sequences are decoded ahead of time by a pool of threads. If the scale parameter is lower than 1, the images of a sequence are scaled down when decoded, so that the corrections applied before scaling work on the reduced images.
+ *
+ * Available parameters:
+ * - url (string): URL to the file to load. A directory, a glob pattern (using the * and ? wildcards) or a numbered pattern (i.e. frames/img_%05d.png, starting at 0 or 1) loads a sequence. A numbered pattern contains exactly one %d, %Nd or %0Nd conversion, other percent signs being written %%. Any other url is loaded as a single image
+ * - readAhead (int[2]): decoding of sequences. Parameters are: [number of decoder threads, default 2] [number of frames decoded ahead, default 8]
+ * - loop (int, default 1): if set to 1, the sequence restarts from its first image once finished
+ * - framerate (int, default 0): rate at which the images of a sequence are output. If set to 0, each image is output as soon as the previous one has been processed
+ *
+ * \subsection source_2d_recording_sec Recorded 2D sources (Source_2D_Recording)
+ *
+ * Replays the raw frames recorded from any other 2D source with its record parameter. Corrections are applied to the replayed frames as for any other source.
  *
  * Available parameters:
- * - url (string): URL to the file to load
+ * - location (string): file path to the recording
+ * - playback (int, default 0): pacing of the frames. 0 replays at the original cadence, 1 at a fixed rate, 2 as fast as the frames are processed
+ * - playbackRate (float, default 30): frame rate used when playback is set to 1
+ * - loop (int, default 1): if set to 1, the recording is replayed from the start once finished
+ * - position (int): index of the next frame to replay
+ *
+ * The following read-only parameter is also available:
+ * - frames: number of frames in the recording
  *
  * \subsection source_2d_shmdata_sec shmdata 2D sources (Source_2D_Shmdata)
  * 
@@ -108,6 +143,10 @@
  *
  * Available parameters:
  * - location (string): file path to the shmdata
+ * - voxelGrid (float, default 0): size of the voxels used to downsample the cloud, in the cloud unit. The points in each voxel are replaced by their mean. 0 to disable
+ * - crop (float[6]): only keeps the points inside the given box. Parameters are: [minX] [maxX] [minY] [maxY] [minZ] [maxZ]. Set all to 0 to disable
+ *
+ * Filtering is applied once for each received cloud, before any actuator uses it.
  * 
  **************
  * \section actuators_sec List of actuators
@@ -147,6 +186,11 @@
  * - measurementNoiseCov (int, default 1e-4): noise of the measurement (capture + detection) of the tracked object. Used for filtering detection.
  * - maxDistanceForColorDiff (float, default 16): maximum distance beyond which the color of blobs is not considered for tracking.
  * - area (int[2], default 0 65535): minimum and maximum areas of the detected objects.
+ * - model (int, default 0): background model. 0 for the mixture of gaussians, 1 for a single running gaussian per pixel (faster, for 8 bits images only)
+ * - tiles (int, default 0): number of horizontal tiles the mixture of gaussians model is split in, to be updated in parallel. 0 for one per CPU
+ * - gaussianThreshold (float, default 2.5): for the running gaussian model, distance to the mean (in standard deviations) above which a pixel is considered foreground
+ * - bgScale (float, default 1.0): scaling applied to the input image for the background subtraction and filtering. Below 1, detected blobs are refined at full resolution
+ * - refineThreshold (float, default 16): when bgScale is below 1, difference to the background above which a pixel is kept while refining a blob
  *
  * OSC output:
  * - name: bgsubtractor
@@ -220,6 +264,7 @@
  * \subsection actuator_hog_sec Histogram of Oriented Gradients (Actuator_Hog)
  *
  * This actuator searches for objects corresponding to the model trained with blobtrainer.
+ * Linear models are collapsed with the PCA transform, if any, into a single weight vector, and windows are scored by batches.
  *
  * Number of source(s) needed: 1 Source_2D
  *
@@ -227,6 +272,7 @@
  * - modelFilename (string): path to the file model
  * - maxTimePerFrame (int, default 1e5): maximum time (in us) to allow for detection at each frame
  * - maxThreads (int, default 4): maximum number of threads to use
+ * - scanStride (int, default 1): stride (in cells) between the evaluated detection windows. Windows are scanned in a fixed order, spread over the whole mask, until maxTimePerFrame is reached
  * - mergeDistance (int, default 64): distance below which detected blobs are merged
  * - maxTrackDistance (float, default 0): distance below which a new detection can be linked to an existing blob. 0 means no limit.
  * - occlusionDistance (float, default 0): distance below two blobs are considered to be overlapping. This increases there lifetime.
@@ -238,6 +284,9 @@
  * - cellMaxSize (int[2], default 0 0): maximum size (in pixels) of a HoG cell, this activates multiscale analysis
  * - cellStep (float[2], default 2 2): factor in both directions to go from cellSize to cellMaxSize, in a multiscale context
  * - bins (int, default 9): number of orientations to consider
+ * - pyramidLevels (int, default 1): number of levels of the image pyramid scanned for detection. Each level is scaled down by pyramidScale from the previous one, so that bigger objects are detected too
+ * - pyramidScale (float, default 1.2): scale factor between two consecutive levels of the pyramid
+ * - pyramidMinScale (float, default 1.0): scale of the first level of the pyramid, between 0.25 and 1. Below 1 the input is upscaled for the first levels, so that objects smaller than the detection window are detected too, at a higher cost
  * - margin (float, default 0.0): margin to the hyperplane to add to the detection (higher = less false positives and less hit rate)
  * - lifetime (int, default 30): time (in frames) during which a blob is kept even if not detected
  * - keepOldBlobs (int[2], default [0]): parameters to not delete blobs which have disappeared. Parameters are: [minAgeToKeep] [maxTimeToKeep]
@@ -245,6 +294,7 @@
  * - measurementNoiseCov (int, default 1e-4): noise of the measurement (capture + detection) of the tracked object. Used for filtering detection.
  * - saveSamples (int, default 0): if set to 1, saves detected samples older than saveSamplesAge
  * - saveSamplesAge (int, default 120): see saveSamples
+ * - saveSamplesFormat (string int): format of the saved samples. Parameters are: [extension, default png] [compression level, 0-9 for png, quality 0-100 for jpg]
  *
  * OSC output:
  * - name: hog
@@ -0,0 +1,112 @@
+/*
+ * Copyright (C) 2013 Emmanuel Durand
+ *
+ * This file is part of blobserver.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @recording.h
+ * RecordingWriter and RecordingReader, to store raw frames in a memory-mapped container file.
+ */
+
+#ifndef RECORDING_H
+#define RECORDING_H
+
+#include <string>
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/*************/
+//! Appends frames and their capture timestamps to a container file, through a memory mapping
+class RecordingWriter
+{
+    public:
+        RecordingWriter();
+        ~RecordingWriter();
+
+        /**
+         * \brief Creates the container file, overwriting any existing one
+         * \return Returns false if the file could not be created or mapped
+         */
+        bool open(const std::string& pFilename);
+
+        /**
+         * \brief Truncates the file to the recorded frames and closes it
+         */
+        void close();
+
+        bool isOpen() const {return mMap != NULL;}
+
+        /**
+         * \brief Appends a frame to the container
+         * \param pFrame Frame to record, of any type
+         * \param pTimestamp Capture time of the frame, in us
+         */
+        bool write(const cv::Mat& pFrame, unsigned long long pTimestamp);
+
+        unsigned long long getFrames() const {return mFrames;}
+
+    private:
+        int mFile;
+        uchar* mMap;
+        size_t mMapSize; //!< Size of the file and of its mapping, grown by chunks
+        size_t mEnd; //!< End of the last recorded frame
+        unsigned long long mFrames;
+
+        bool reserve(size_t pSize);
+};
+
+/*************/
+//! Gives access to the frames of a container file written by RecordingWriter, without copying them
+class RecordingReader
+{
+    public:
+        RecordingReader();
+        ~RecordingReader();
+
+        /**
+         * \brief Maps the container file and indexes its frames
+         * \return Returns false if the file could not be mapped or is not a recording
+         */
+        bool open(const std::string& pFilename);
+        void close();
+
+        bool isOpen() const {return mMap != NULL;}
+
+        /**
+         * \brief Gets the number of frames in the container
+         */
+        size_t size() const {return mFrames.size();}
+
+        /**
+         * \brief Gets a frame. The returned cv::Mat points to the read-only mapping, and is only valid until close() is called
+         */
+        cv::Mat getFrame(size_t pIndex) const;
+
+        /**
+         * \brief Gets the capture timestamp of a frame, in us
+         */
+        unsigned long long getTimestamp(size_t pIndex) const;
+
+    private:
+        int mFile;
+        uchar* mMap;
+        size_t mMapSize;
+        std::vector<size_t> mFrames; //!< Offset of each frame record
+};
+
+#endif // RECORDING_H
@@ -23,11 +23,23 @@
 #define SHMPOINTCLOUD_H
 
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
 #include <functional>
 #include <iostream>
+#include <algorithm>
 #include <memory>
 #include <mutex>
 #include <sstream>
+#include <thread>
+#include <vector>
+
+#include "opencv2/opencv.hpp"
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
 
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
@@ -90,6 +102,14 @@ class NetworkPointCloudCompression : public pio::OctreePointCloudCompression<Poi
          */
         void decodeNetworkPointCloud(std::istream &compressedTreeDataIn_arg, PointCloudPtr &cloud_arg);
 
+        /**
+         * \brief Check whether the given compressed data holds an I-frame, from its frame header
+         * \param data Compressed data, starting with the frame header
+         * \param size Size of the data
+         * \return True for an I-frame, false for a P-frame or an unreadable header
+         */
+        static bool isIFrame(const char* data, const size_t size);
+
     private:
         PointCloudPtr validFrame_;
         bool firstFrame_;
@@ -125,6 +145,22 @@ void NetworkPointCloudCompression<PointT, LeafT, BranchT, OctreeT>::decodeNetwor
     }
 }
 
+/*************/
+template<typename PointT, typename LeafT, typename BranchT, typename OctreeT>
+bool NetworkPointCloudCompression<PointT, LeafT, BranchT, OctreeT>::isIFrame(const char* data, const size_t size)
+{
+    // The frame header holds the identifier, then the frame ID and the frame type
+    const char* identifier = pio::OctreePointCloudCompression<PointT, LeafT, BranchT, OctreeT>::frame_header_identifier_;
+    const size_t identifierSize = strlen(identifier);
+    const size_t typeOffset = identifierSize + sizeof(unsigned int);
+    if (size < typeOffset + sizeof(bool) || strncmp(data, identifier, identifierSize) != 0)
+        return false;
+
+    bool iFrame;
+    memcpy(&iFrame, data + typeOffset, sizeof(bool));
+    return iFrame;
+}
+
 /*************/
 //! PointCloudBlob class, designed to carry uncompressed cloud over the network
 template <typename T>
@@ -159,9 +195,21 @@ class PointCloudBlob
          */
         typename pcl::PointCloud<T>::Ptr toCloud(const void* blob, const int size, unsigned long long* timestamp = NULL);
 
+        /**
+         * \brief Decodes the specified binary blob into an existing PointCloud, reusing its allocation
+         * \param blob Pointer to the binary blob to decode
+         * \param size Size of the blob
+         * \param cloud Cloud to decode to. It is allocated if empty
+         * \param timestamp Timestamp will be stored in this pointer
+         */
+        void toCloud(const void* blob, const int size, typename pcl::PointCloud<T>::Ptr &cloud, unsigned long long* timestamp = NULL);
+
     private:
         float* _blob;
         unsigned int _size;
+
+        // True if T stores xyz in its first 16 bytes, and rgb at the start of the next 16 (as PointXYZRGBA and PointXYZRGB do)
+        static bool isPackedLayout();
 };
 
 /*************/
@@ -172,6 +220,16 @@ PointCloudBlob<T>::PointCloudBlob()
     _size = 0;
 }
 
+/*************/
+template <typename T>
+bool PointCloudBlob<T>::isPackedLayout()
+{
+    T point;
+    return sizeof(T) == 8 * sizeof(float)
+        && (char*)&point.x == (char*)&point
+        && (char*)&point.rgb - (char*)&point == 4 * sizeof(float);
+}
+
 /*************/
 template <typename T>
 void* PointCloudBlob<T>::toBlob(typename pcl::PointCloud<T>::Ptr &cloud, int &size, const unsigned long long timestamp)
@@ -180,20 +238,36 @@ void* PointCloudBlob<T>::toBlob(typename pcl::PointCloud<T>::Ptr &cloud, int &si
     const size_t cloudSize = cloud->size();
     const unsigned int blobSize = cloudSize * (3 + 1); // each point is 3 floats for xyz and one float for the color
 
+    // The buffer only grows, by at least half its size to limit reallocations for clouds of varying size
     if (blobSize > _size)
     {
         free(_blob);
-        _blob = (float*)malloc(blobSize*sizeof(float) + sizeof(unsigned long long));
-        _size = blobSize;
+        _size = std::max(blobSize, _size + _size / 2);
+        _blob = (float*)malloc(_size*sizeof(float) + sizeof(unsigned long long));
     }
 
     unsigned long long* stampPtr = (unsigned long long*)_blob;
     *stampPtr = timestamp;
 
     float* blobPtr = (float*)((char*)_blob + sizeof(unsigned long long));
-    for (unsigned int i = 0; i < cloudSize; ++i)
+    const T* points = cloud->points.data();
+    unsigned int i = 0;
+#if CV_SSE2
+    if (isPackedLayout())
+    {
+        // Points are 16 bytes aligned in PCL clouds: xyz is loaded at once, and the color inserted as the fourth value
+        for (; i < cloudSize; ++i)
+        {
+            __m128 xyz = _mm_load_ps(&points[i].x);
+            __m128 color = _mm_load_ss(&points[i].rgb);
+            __m128 zColor = _mm_shuffle_ps(color, xyz, _MM_SHUFFLE(2, 2, 0, 0));
+            _mm_storeu_ps(blobPtr + i*4, _mm_shuffle_ps(xyz, zColor, _MM_SHUFFLE(0, 2, 1, 0)));
+        }
+    }
+#endif
+    for (; i < cloudSize; ++i)
     {
-        T* point = &(cloud->at(i));
+        const T* point = &points[i];
         blobPtr[i*4 + 0] = point->x;
         blobPtr[i*4 + 1] = point->y;
         blobPtr[i*4 + 2] = point->z;
@@ -209,6 +283,22 @@ template <typename T>
 typename pcl::PointCloud<T>::Ptr PointCloudBlob<T>::toCloud(const void* blob, const int size, unsigned long long* timestamp)
 {
     typename pcl::PointCloud<T>::Ptr cloud(new pcl::PointCloud<T>());
+    toCloud(blob, size, cloud, timestamp);
+    return cloud;
+}
+
+/*************/
+template <typename T>
+void PointCloudBlob<T>::toCloud(const void* blob, const int size, typename pcl::PointCloud<T>::Ptr &cloud, unsigned long long* timestamp)
+{
+    if (cloud.get() == NULL)
+        cloud.reset(new pcl::PointCloud<T>());
+
+    if (size < (int)sizeof(unsigned long long))
+    {
+        cloud->clear();
+        return;
+    }
 
     if (timestamp != NULL)
     {
@@ -220,26 +310,48 @@ typename pcl::PointCloud<T>::Ptr PointCloudBlob<T>::toCloud(const void* blob, co
     const float* newBlob = (float*)((char*)blob + sizeof(unsigned long long));
     const unsigned int cloudSize = (size - sizeof(unsigned long long)) / (4*sizeof(float));
 
-    cloud->reserve(cloudSize);
+    // The cloud keeps its allocation if it is large enough
+    cloud->resize(cloudSize);
+    cloud->width = cloudSize;
+    cloud->height = 1;
 
-    for (unsigned int i = 0; i < cloudSize; ++i)
+    T* points = cloud->points.data();
+    unsigned int i = 0;
+#if CV_SSE2
+    if (isPackedLayout())
+    {
+        // Both halves of each point are written at once: xyz followed by 1, then the color followed by zeros
+        const __m128 one = _mm_set1_ps(1.f);
+        const __m128 zero = _mm_setzero_ps();
+        for (; i < cloudSize; ++i)
+        {
+            __m128 values = _mm_loadu_ps(newBlob + i*4);
+            __m128 zOne = _mm_shuffle_ps(values, one, _MM_SHUFFLE(0, 0, 2, 2));
+            _mm_store_ps(&points[i].x, _mm_shuffle_ps(values, zOne, _MM_SHUFFLE(2, 0, 1, 0)));
+            __m128 color = _mm_shuffle_ps(values, values, _MM_SHUFFLE(3, 3, 3, 3));
+            _mm_store_ps(&points[i].rgb, _mm_move_ss(zero, color));
+        }
+    }
+#endif
+    for (; i < cloudSize; ++i)
     {
-        T point;
+        T& point = points[i];
         point.x = newBlob[i*4 + 0];
         point.y = newBlob[i*4 + 1];
         point.z = newBlob[i*4 + 2];
         point.rgb = newBlob[i*4 + 3];
-
-        cloud->push_back(point);
     }
-
-    return cloud;
 }
 
 /*************/
 #define SHMCLOUD_TYPE_BASE          "application/x-pcl"
 #define SHMCLOUD_TYPE_COMPRESSED    "application/x-pcd"
 
+// Number of compressed clouds waiting to be decoded above which the oldest ones are dropped.
+// P-frames are encoded relatively to the previous cloud, so only whole runs of clouds preceding
+// a pending I-frame are dropped: as long as no I-frame is pending, the queue keeps growing
+#define SHMCLOUD_MAX_PENDING        4
+
 /*************/
 //! ShmPointCloud class, to write point clouds to shmdata
 template <typename T>
@@ -289,9 +401,10 @@ class ShmPointCloud
         /**
          * \brief Get the latest point cloud received. Only meaningful if the ShmPointCloud is set as a reader.
          * \param cloud Reference to the cloud where to write
+         * \param index If not NULL, set to the number of clouds decoded so far, which identifies the returned cloud
          * \return The timestamp
          */
-        unsigned long long getCloud(cloudPtr &cloud) const;
+        unsigned long long getCloud(cloudPtr &cloud, unsigned long long* index = NULL) const;
 
         /**
          * \brief Set a new point cloud to the shmdata. Only meaningful if the ShmPointCloud is set as a writer.
@@ -302,16 +415,26 @@ class ShmPointCloud
         void setCloud(const cloudPtr &cloud, const bool compress = false, const unsigned long long timestamp = 0);
 
     private:
+        //! Data received from the shmdata, waiting to be decoded
+        struct Packet
+        {
+            std::vector<char> data;
+            bool compressed;
+            bool iFrame; //!< True if the packet does not depend on the previous ones
+        };
+
         bool _isWriter;
 
         string _filename;
 
         shmdata_any_writer_t* _writer;
         shmdata_any_reader_t* _reader;
-        cloudPtr _cloud;
+        cloudPtr _cloud; //!< Latest fully decoded cloud
+        cloudPtr _backCloud; //!< Previous cloud, reused for decoding when nobody holds it anymore
 
         mutable bool _updated;
         unsigned long long _timestamp;
+        unsigned long long _cloudIndex;
 	unsigned long long _startTime;
 
         char* _dataBuffer;
@@ -319,9 +442,18 @@ class ShmPointCloud
 
         mutable std::mutex _mutex;
 
+        // Decoding is done in its own thread, so as not to block the shmdata reader
+        std::thread _decoder;
+        std::deque<Packet> _packets;
+        std::vector<std::vector<char>> _freeBuffers; //!< Packet buffers, recycled once decoded
+        std::mutex _packetMutex;
+        std::condition_variable _packetCondition;
+        bool _stopDecoder;
+
         std::shared_ptr<NetworkPointCloudCompression<T>> _networkPointCloudEncoder;
         std::shared_ptr<PointCloudBlob<T>> _blober;
 
+        void decode();
         static void onData(shmdata_any_reader_t* reader, void* shmbuf, void* data, int data_size, unsigned long long timestamp,
             const char* type_description, void* user_data);
 };
@@ -332,7 +464,10 @@ ShmPointCloud<T>::ShmPointCloud(const char* filename, const bool isWriter) :
     _writer(NULL),
     _reader(NULL),
     _updated(false),
-    _startTime(0)
+    _timestamp(0),
+    _cloudIndex(0),
+    _startTime(0),
+    _stopDecoder(false)
 {
     _cloud.reset(new pcl::PointCloud<T>());
 
@@ -356,6 +491,8 @@ ShmPointCloud<T>::ShmPointCloud(const char* filename, const bool isWriter) :
     }
     else
     {
+        _decoder = std::thread(&ShmPointCloud<T>::decode, this);
+
         // Shmdata reader
         _reader = shmdata_any_reader_init();
         shmdata_any_reader_run_gmainloop(_reader, SHMDATA_FALSE);
@@ -376,6 +513,16 @@ ShmPointCloud<T>::~ShmPointCloud()
     if (_reader != NULL)
         shmdata_any_reader_close(_reader);
 
+    if (_decoder.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(_packetMutex);
+            _stopDecoder = true;
+        }
+        _packetCondition.notify_all();
+        _decoder.join();
+    }
+
     if (_writer != NULL)
         shmdata_any_writer_close(_writer);
 
@@ -389,6 +536,8 @@ void ShmPointCloud<T>::setCompression(pio::compression_Profiles_e compressionPro
                                       bool doVoxelGridDownDownSampling, const unsigned int iFrameRate,
                                       bool doColorEncoding, const unsigned char colorBitResolution)
 {
+    // The decoder thread may be using the current encoder
+    std::lock_guard<std::mutex> lock(_packetMutex);
     _networkPointCloudEncoder.reset(new NetworkPointCloudCompression<T>(compressionProfile, showStatistics, pointResolution,
                                                                         octreeResolution, doVoxelGridDownDownSampling, iFrameRate,
                                                                         doColorEncoding, colorBitResolution));
@@ -396,10 +545,12 @@ void ShmPointCloud<T>::setCompression(pio::compression_Profiles_e compressionPro
 
 /*************/
 template <typename T>
-unsigned long long ShmPointCloud<T>::getCloud(cloudPtr &cloud) const
+unsigned long long ShmPointCloud<T>::getCloud(cloudPtr &cloud, unsigned long long* index) const
 {
     std::lock_guard<std::mutex> lock(_mutex);
     cloud = _cloud;
+    if (index != NULL)
+        *index = _cloudIndex;
     _updated = false;
     return _timestamp;
 }
@@ -456,33 +607,31 @@ void ShmPointCloud<T>::setCloud(const cloudPtr &cloud, const bool compress, cons
     // Timestamp is added to the start of the buffer
     if (compress)
     {
-        unsigned long long* stampBuffer = (unsigned long long*)_dataBuffer;
-        *stampBuffer = currentTime;
-
         stringstream compressedData;
         // TODO: We should check if the next line is necessary in the future. As of yet, without it the whole history
         // of all clouds is kepts unless a big change happens...
         _networkPointCloudEncoder->deleteTree();
         _networkPointCloudEncoder->encodePointCloud(lCloud, compressedData);
-        compressedData.read(reinterpret_cast<char*>(_dataBuffer + sizeof(unsigned long long)), _dataBufferSize);
+        const string compressedString = compressedData.str();
 
-        unsigned int size = compressedData.gcount() + sizeof(unsigned long long);
-        if (size >= _dataBufferSize)
-        {
-            // It is likely that the buffer is too short, we will resize it
-            free(_dataBuffer);
-            _dataBufferSize *= 2;
-            _dataBuffer = (char*)malloc(_dataBufferSize*sizeof(char));
-        }
-        else
+        // The buffer grows to hold the whole compressed cloud, and is kept for the next ones
+        unsigned int size = compressedString.size() + sizeof(unsigned long long);
+        if (size > _dataBufferSize)
         {
-            shmdata_any_writer_push_data(_writer, 
-					 _dataBuffer, 
-					 size, 
-					 (currentTime - _startTime) * 1e6, //nsec
-					 NULL, 
-					 NULL);
+            _dataBufferSize = std::max(size, _dataBufferSize * 2);
+            _dataBuffer = (char*)realloc(_dataBuffer, _dataBufferSize*sizeof(char));
         }
+
+        unsigned long long* stampBuffer = (unsigned long long*)_dataBuffer;
+        *stampBuffer = currentTime;
+        memcpy(_dataBuffer + sizeof(unsigned long long), compressedString.data(), compressedString.size());
+
+        shmdata_any_writer_push_data(_writer, 
+                     _dataBuffer, 
+                     size, 
+                     (currentTime - _startTime) * 1e6, //nsec
+                     NULL, 
+                     NULL);
     }
     else
     {
@@ -507,36 +656,128 @@ void ShmPointCloud<T>::onData(shmdata_any_reader_t* reader, void* shmbuf, void*
     const char* type_description, void* user_data)
 {
     ShmPointCloud* context = static_cast<ShmPointCloud*>(user_data);
-    
-    std::lock_guard<std::mutex> lock(context->_mutex);
-
-    cloudPtr cloudOut(new pcl::PointCloud<T>());
 
-    unsigned long long stamp;
     string dataType(type_description);
-    if (dataType == string(SHMCLOUD_TYPE_COMPRESSED))
+    bool compressed = (dataType == string(SHMCLOUD_TYPE_COMPRESSED));
+    if (!compressed && dataType != string(SHMCLOUD_TYPE_BASE))
     {
-        unsigned long long* stampPtr = (unsigned long long*)data;
-        stamp = *stampPtr;
-
-        std::stringstream compressedData;
-        compressedData.write((const char*)data + sizeof(unsigned long long), data_size);
-        context->_networkPointCloudEncoder->decodeNetworkPointCloud(compressedData, cloudOut);
-        context->_cloud = cloudOut;
+        shmdata_any_reader_free(shmbuf);
+        return;
     }
-    else if (dataType == string(SHMCLOUD_TYPE_BASE))
+
+    // The data is only copied here, so that the shared memory is given back right away
     {
-        context->_cloud = context->_blober->toCloud(data, data_size, &stamp);
+        std::lock_guard<std::mutex> lock(context->_packetMutex);
+
+        bool iFrame = true;
+        if (compressed)
+        {
+            const size_t stampSize = sizeof(unsigned long long);
+            iFrame = data_size > (int)stampSize
+                && NetworkPointCloudCompression<T>::isIFrame((const char*)data + stampSize, data_size - stampSize);
+        }
+
+        // Uncompressed clouds do not depend on each other, only the newest one is worth decoding.
+        // Compressed clouds are decoded in order, as P-frames are encoded relatively to the previous one:
+        // when too many are pending, only the ones preceding the newest I-frame can be dropped
+        unsigned int maxPending = compressed ? SHMCLOUD_MAX_PENDING - 1 : 0;
+        if (context->_packets.size() > maxPending)
+        {
+            unsigned int dropped = 0;
+            if (iFrame)
+                dropped = context->_packets.size();
+            else
+                for (unsigned int i = context->_packets.size(); i > 0; --i)
+                    if (context->_packets[i - 1].iFrame)
+                    {
+                        dropped = i - 1;
+                        break;
+                    }
+
+            for (unsigned int i = 0; i < dropped; ++i)
+            {
+                context->_freeBuffers.push_back(std::move(context->_packets.front().data));
+                context->_packets.pop_front();
+            }
+        }
+
+        Packet packet;
+        if (context->_freeBuffers.size() != 0)
+        {
+            packet.data = std::move(context->_freeBuffers.back());
+            context->_freeBuffers.pop_back();
+        }
+        packet.data.assign((const char*)data, (const char*)data + data_size);
+        packet.compressed = compressed;
+        packet.iFrame = iFrame;
+        context->_packets.push_back(std::move(packet));
     }
-    else
+    context->_packetCondition.notify_one();
+
+    shmdata_any_reader_free(shmbuf);
+}
+
+/*************/
+template <typename T>
+void ShmPointCloud<T>::decode()
+{
+    while (true)
     {
-        return;
-    }
+        Packet packet;
+        std::shared_ptr<NetworkPointCloudCompression<T>> encoder;
+        {
+            std::unique_lock<std::mutex> lock(_packetMutex);
+            while (!_stopDecoder && _packets.size() == 0)
+                _packetCondition.wait(lock);
 
-    context->_timestamp = stamp;
-    context->_updated = true;
+            if (_stopDecoder)
+                return;
 
-    shmdata_any_reader_free(shmbuf);
+            packet = std::move(_packets.front());
+            _packets.pop_front();
+            encoder = _networkPointCloudEncoder;
+        }
+
+        // The back buffer is reused only if no consumer holds it anymore
+        cloudPtr cloud;
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (_backCloud.get() != NULL && _backCloud.unique())
+                cloud = _backCloud;
+            _backCloud.reset();
+        }
+
+        unsigned long long stamp = 0;
+        if (packet.compressed)
+        {
+            if (packet.data.size() >= sizeof(unsigned long long))
+            {
+                stamp = *(const unsigned long long*)packet.data.data();
+
+                std::stringstream compressedData;
+                compressedData.write(packet.data.data() + sizeof(unsigned long long), packet.data.size() - sizeof(unsigned long long));
+                cloud.reset(new pcl::PointCloud<T>());
+                encoder->decodeNetworkPointCloud(compressedData, cloud);
+            }
+        }
+        else
+        {
+            _blober->toCloud(packet.data.data(), packet.data.size(), cloud, &stamp);
+        }
+
+        if (cloud.get() != NULL)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _backCloud = _cloud;
+            _cloud = cloud;
+            _timestamp = stamp;
+            _cloudIndex++;
+            _updated = true;
+        }
+
+        std::lock_guard<std::mutex> lock(_packetMutex);
+        _freeBuffers.push_back(std::move(packet.data));
+    }
 }
 
 #endif // SHMPOINTCLOUD_H
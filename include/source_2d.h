@@ -26,6 +26,7 @@
 #define SOURCE_2D_H
 
 #include <atomic>
+#include <functional>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -39,9 +40,12 @@
 #include "config.h"
 #include "constants.h"
 #include "capture.h"
+#include "framewriter.h"
 #include "helpers.h"
 #include "hdribuilder.h"
+#include "recording.h"
 #include "source.h"
+#include "tonemapper.h"
 
 /*************/
 //! A simple buffer of cv::Mat
@@ -179,6 +183,10 @@ class Source_2D : public Source
 
         bool mHdriActive;
 
+        // Scale already applied by the source to the raw frames, the scale correction only doing the rest
+        float mRawScale;
+        float getScale() const {return mScale;}
+
         // Base methods for any type of source
         void setBaseParameter(atom::Message pParam);
         atom::Message getBaseParameter(atom::Message pParam) const;
@@ -189,14 +197,32 @@ class Source_2D : public Source
 
         // Thread in which corrections are applied
         std::shared_ptr<std::thread> mCorrectionThread;
-        std::mutex mCorrectionMutex;
+        mutable std::mutex mCorrectionMutex;
         bool mIsRunning;
 
-        // Mask
-        cv::Mat mMask;
+        // Correction pipeline
+        struct CorrectionStage
+        {
+            std::string name; //!< Name of the stage, identical to the parameter which configures it
+            std::function<bool()> isActive; //!< Returns true if the stage has been configured
+            std::function<bool(cv::Mat&, cv::Mat&)> apply; //!< Applies the stage from input to output, returns false if no valid frame was produced
+            bool inPlace; //!< If true, the stage modifies its input directly and the output is ignored
+            bool enabled; //!< Allows for disabling a configured stage
+            unsigned long long duration; //!< Accumulated processing time, in us
+            unsigned long long calls; //!< Number of times the stage has been applied
+        };
+        std::vector<CorrectionStage> mCorrectionStages;
+        cv::Mat mScratchBuffers[2]; //!< Ping-pong buffers for stages which can not work in place
+
+        // Mask, expanded to the pixel size of the frames
+        MaskCache mMask;
         
-        // Noise reduction parameter
+        // Noise reduction parameters
         bool mFilterNoise;
+        bool mFilterTemporal;
+        float mTemporalWeight; //!< Weight of the new frame in the recursive average
+        float mTemporalThreshold; //!< Difference above which a pixel is considered moving, and not averaged
+        cv::Mat mTemporalAccumulator; //!< Running average, in fixed point
 
         // Basic geometric correction parameters
         float mScale;
@@ -230,6 +256,10 @@ class Source_2D : public Source
         float mHdriStartExposure, mHdriStepSize;
         int mHdriSteps, mHdriFrameSkip;
 
+        // Tonemapping of float images to 8 bits
+        bool mTonemapping;
+        Tonemapper mTonemapper;
+
         // Color correction
         cmsHTRANSFORM mICCTransform;
         
@@ -242,6 +272,13 @@ class Source_2D : public Source
         std::string mBaseFilename;
         int mSavePeriod;
         int mSaveIndex, mSavePhase;
+        std::shared_ptr<FrameWriter> mFrameWriter; //!< Created when saving is first activated
+        std::string mSaveExtension;
+        int mSaveCompression;
+        int mSaveThreads, mSaveQueueSize, mSaveDropPolicy;
+
+        // Recording of the raw frames, to be replayed by Source_2D_Recording
+        RecordingWriter mRecorder;
 
         /************/
         // Methods
@@ -251,24 +288,30 @@ class Source_2D : public Source
         // Raw frame correction method
         void applyCorrections();
 
+        // Correction pipeline setup
+        void initCorrectionStages();
+        void addCorrectionStage(std::string pName, std::function<bool()> pIsActive, std::function<bool(cv::Mat&, cv::Mat&)> pApply, bool pInPlace);
+        void setCorrectionOrder(std::vector<std::string> pNames);
+
         // Mask
         void applyMask(cv::Mat& pImg);
 
         // Noise correction
-        void filterNoise(cv::Mat& pImg);
+        void filterNoise(const cv::Mat& pImg, cv::Mat& pOutput);
+        void filterTemporal(cv::Mat& pImg);
 
         // Gamma correction
         void correctGamma(cv::Mat& pImg);
 
         // Basic geometric corrections
-        void scale(cv::Mat& pImg);
-        void rotate(cv::Mat& pImg);
+        void scale(const cv::Mat& pImg, cv::Mat& pOutput);
+        void rotate(const cv::Mat& pImg, cv::Mat& pOutput);
         void crop(cv::Mat& pImg);
 
         // Methods to correct the optical distortion
         void correctVignetting(cv::Mat& pImg);
-        void correctDistortion(cv::Mat& pImg);
-        void correctFisheye(cv::Mat& pImg);
+        void correctDistortion(const cv::Mat& pImg, cv::Mat& pOutput);
+        void correctFisheye(const cv::Mat& pImg, cv::Mat& pOutput);
 
         // Method related to colorimetry. Default output profile is sRGB
         cmsHTRANSFORM loadICCTransform(std::string pFile);
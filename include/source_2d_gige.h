@@ -32,6 +32,7 @@
 
 #include <arv.h>
 #include <mutex>
+#include <vector>
 
 class Source_2D_Gige : public Source_2D
 {
@@ -57,8 +58,9 @@ class Source_2D_Gige : public Source_2D
         static std::string mClassName;
         static std::string mDocumentation;
 
-        cv::Mat mConvertedFrame;
+        cv::Mat mConvertedFrame; //!< Latest converted frame, taken from the pool
         std::mutex mFrameMutex;
+        std::vector<cv::Mat> mFramePool; //!< Frames converted from the stream, only accessed from the stream callback
 
         ArvCamera* mCamera;
         ArvStream* mStream;
@@ -68,6 +70,7 @@ class Source_2D_Gige : public Source_2D
         // Methods
         void make(std::string pParam);
         void allocateStream();
+        cv::Mat getPooledFrame(int pRows, int pCols, int pType);
         static void streamCb(void* user_data, ArvStreamCallbackType type, ArvBuffer* buffer);
 };
 
@@ -25,6 +25,14 @@
 #ifndef SOURCE_2D_IMAGE_H
 #define SOURCE_2D_IMAGE_H
 
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
+
 #include "source_2d.h"
 
 class Source_2D_Image : public Source_2D
@@ -51,9 +59,40 @@ class Source_2D_Image : public Source_2D
         static std::string mClassName;
         static std::string mDocumentation;
 
-        cv::Mat mImage;
+        cv::Mat mImage; //!< Used when a single image is loaded
+
+        // Image sequences, from a directory, a glob pattern or a numbered pattern
+        struct DecodedFrame
+        {
+            cv::Mat image;
+            float scale; //!< Scale the image has been decoded at
+            cv::Size size; //!< Resolution of the file, before any scaling
+        };
+
+        std::vector<std::string> mFiles;
+        std::map<size_t, DecodedFrame> mCache; //!< Decoded frames ahead of the current one
+        std::set<size_t> mPending; //!< Frames being decoded
+        std::mutex mCacheMutex;
+        std::condition_variable mCacheCondition;
+        std::vector<std::thread> mDecoders;
+        bool mStopDecoders;
+
+        unsigned int mDecoderNbr, mCacheSize;
+        bool mLoop;
+        long long mPosition; //!< Index of the current frame, -1 before the first one
+        cv::Mat mCurrentFrame;
+        float mCurrentScale;
+        std::chrono::high_resolution_clock::time_point mLastFrameTime;
 
         void make(std::string pParam);
+
+        // Fills mFiles from the given url, returns false if it is a single image
+        bool listFiles(const std::string& pUrl);
+        void startDecoders();
+        void stopDecoders();
+        void decode();
+        // Index of the k-th frame after the current one, or -1 if there is none
+        long long getNextIndex(unsigned int pOffset) const;
 };
 
 #endif // SOURCE_2D_IMAGE_H
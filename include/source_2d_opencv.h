@@ -25,11 +25,25 @@
 #ifndef SOURCE_2D_OPENCV_H
 #define SOURCE_2D_OPENCV_H
 
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
 #include "source_2d.h"
 
 class Source_2D_OpenCV : public Source_2D
 {
     public:
+        //! How frames decoded from a file or a stream are output
+        enum Playback
+        {
+            realTime = 0, //!< Decoding follows the frame timestamps, and only the newest decoded frame is output
+            lossless //!< Every frame is output, decoding waiting for the previous ones to be processed
+        };
+
         Source_2D_OpenCV();
         Source_2D_OpenCV(std::string pParam);
         ~Source_2D_OpenCV();
@@ -52,9 +66,24 @@ class Source_2D_OpenCV : public Source_2D
         static std::string mDocumentation;
 
         cv::VideoCapture mCamera;
+        std::mutex mCaptureMutex; //!< Protects mCamera when decoding in its own thread
         std::string mVideoUrl;
 
+        // Files and streams are decoded in their own thread, into a bounded queue
+        std::shared_ptr<std::thread> mDecodeThread;
+        std::atomic_bool mIsDecoding;
+        std::deque<cv::Mat> mQueue;
+        std::mutex mQueueMutex;
+        std::condition_variable mQueueCondition;
+        unsigned int mQueueSize;
+        std::atomic_int mPlayback;
+        std::atomic_ullong mDropped;
+
         void make(std::string pParam);
+
+        void startDecoding();
+        void stopDecoding();
+        void decode();
 };
 
 #endif // SOURCE_2D_OPENCV_H
@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2013 Emmanuel Durand
+ *
+ * This file is part of blobserver.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @source_2d_recording.h
+ * The Source_2D_Recording class.
+ */
+
+#ifndef SOURCE_2D_RECORDING_H
+#define SOURCE_2D_RECORDING_H
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "recording.h"
+#include "source_2d.h"
+
+class Source_2D_Recording : public Source_2D
+{
+    public:
+        //! How frames are paced during replay
+        enum PlaybackMode
+        {
+            originalCadence = 0, //!< Frames are output with the intervals they were captured with
+            fixedRate, //!< Frames are output at the rate set by the framerate parameter
+            asFastAsPossible //!< A new frame is output as soon as the previous one has been processed
+        };
+
+        Source_2D_Recording();
+        Source_2D_Recording(std::string pParam);
+        ~Source_2D_Recording();
+
+        static std::string getClassName() {return mClassName;}
+        static std::string getDocumentation() {return mDocumentation;}
+
+        atom::Message getSubsources() const; 
+
+        bool connect();
+        bool disconnect();
+        bool grabFrame();
+        cv::Mat retrieveRawFrame();
+
+        void setParameter(atom::Message pParam);
+        atom::Message getParameter(atom::Message pParam) const;
+
+    private:
+        static std::string mClassName;
+        static std::string mDocumentation;
+
+        RecordingReader mReader; //!< Protected by mMutex
+        std::shared_ptr<std::thread> mPlaybackThread;
+        std::atomic_bool mIsPlaying;
+
+        std::atomic_int mPlayback;
+        std::atomic_bool mLoop;
+        float mPlaybackRate;
+        std::atomic_ullong mPosition; //!< Index of the next frame to output
+        std::atomic_bool mRestart; //!< Set when the pacing has to be reset
+
+        void make(std::string pParam);
+        void play();
+        void stop();
+};
+
+#endif // SOURCE_2D_RECORDING_H
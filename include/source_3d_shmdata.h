@@ -26,6 +26,7 @@
 #define SOURCE_3D_SHM
 
 #include <memory>
+#include <mutex>
 
 #include <glib.h>
 #include <atom/message.h>
@@ -67,7 +68,19 @@ class Source_3D_Shmdata : public Source
 
         std::shared_ptr< ShmPointCloud<pcl::PointXYZRGBA> > mShm;
 
+        // The capture is built once per received cloud, and shared by all its consumers
+        std::mutex mCaptureMutex;
+        Capture_3D_PclRgba_Ptr mCapture;
+        unsigned long long mCaptureIndex; //!< Index of the cloud the capture was built from
+        bool mUpdateCapture; //!< Set when the filtering parameters change
+
+        // Filtering applied to each received cloud
+        float mVoxelSize; //!< Size of the voxel grid, 0 to disable it
+        bool mCrop;
+        float mCropBox[6]; //!< Pass-through bounds: minX maxX minY maxY minZ maxZ
+
         void make(std::string pParam);
+        pcl::PointCloud<pcl::PointXYZRGBA>::Ptr filterCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr& pCloud);
 };
 
 #endif // HAVE_PCL && HAVE_SHMDATA
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2013 Emmanuel Durand
+ *
+ * This file is part of blobserver.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * blobserver is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with blobserver.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * @tonemapper.h
+ * Tonemapper, a class to convert HDR images to 8 bits.
+ */
+
+#ifndef TONEMAPPER_H
+#define TONEMAPPER_H
+
+#include <vector>
+
+#include <opencv2/opencv.hpp>
+
+/*************/
+class Tonemapper
+{
+    public:
+        enum tonemapOperator
+        {
+            gamma = 0, // Values are divided by the reference, clipped, then gamma corrected
+            reinhard // Values are compressed with a Reinhard curve, the reference mapping to white
+        };
+
+        Tonemapper();
+
+        void setOperator(tonemapOperator pOperator);
+        // Percentile of the values used as the reference (white) value. 100 means the maximum
+        void setPercentile(float pPercentile) {mPercentile = std::max(0.f, std::min(100.f, pPercentile));}
+        void setGamma(float pGamma);
+
+        // Converts a float image (1 to 4 channels) to 8 bits with the same number of channels
+        // Returns false if the input is not a float image
+        bool process(const cv::Mat& pInput, cv::Mat& pOutput);
+
+        // Returns the reference value used for the last processed image
+        float getReference() const {return mReference;}
+
+    private:
+        tonemapOperator mOperator;
+        float mPercentile;
+        float mGamma;
+        float mReference;
+
+        // LUT from a normalized value to 8 bits
+        std::vector<uchar> mLUT;
+        bool mUpdateLUT;
+
+        float computeReference(const cv::Mat& pInput);
+        void updateLUT();
+};
+
+#endif // TONEMAPPER_H
@@ -48,12 +48,12 @@ void Actuator_ArmPcl::make()
 /*************/
 atom::Message Actuator_ArmPcl::detect(vector<Capture_Ptr> pCaptures)
 {
-    vector< pcl::PointCloud<pcl::PointXYZRGBA>::Ptr > pointclouds;
+    vector<Capture_3D_PclRgba_Ptr> pointclouds;
     for_each (pCaptures.begin(), pCaptures.end(), [&] (Capture_Ptr capture)
     {
         Capture_3D_PclRgba_Ptr pcl = dynamic_pointer_cast<Capture_3D_PclRgba>(capture);
-        if (pcl.get() != NULL)
-            pointclouds.push_back(pcl->get());
+        if (pcl.get() != NULL && pcl->get().get() != NULL)
+            pointclouds.push_back(pcl);
     });
 
     if (pointclouds.size() == 0)
@@ -62,7 +62,7 @@ atom::Message Actuator_ArmPcl::detect(vector<Capture_Ptr> pCaptures)
         return mLastMessage;
     }
 
-    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pcl = pointclouds[0];
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pcl = pointclouds[0]->get();
 
     if (pcl->points.size() < 3)
     {
@@ -108,8 +108,8 @@ atom::Message Actuator_ArmPcl::detect(vector<Capture_Ptr> pCaptures)
         }
     }
 
-    pcl::search::KdTree<pcl::PointXYZRGBA>::Ptr tree(new pcl::search::KdTree<pcl::PointXYZRGBA>());
-    tree->setInputCloud(pcl);
+    // The index is shared with the other actuators using the same capture
+    pcl::search::Search<pcl::PointXYZRGBA>::Ptr tree = pointclouds[0]->getSearch();
     vector<int> indices(maxIndex);
     vector<float> squaredDistances(maxIndex);
     tree->nearestKSearch(pcl->at(maxIndex), mNeighboursNbr, indices, squaredDistances);
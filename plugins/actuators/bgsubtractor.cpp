@@ -6,8 +6,192 @@
 #include <thread>
 #include <utility>
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+#define GAUSSIAN_INITIAL_VARIANCE 225.f
+#define GAUSSIAN_MIN_VARIANCE 16.f
+#define HISTOGRAM_BINS 32
+#define HISTOGRAM_SHIFT 3 // 256 values / HISTOGRAM_BINS
+
+/*************/
+// Updates each tile of the mixture of gaussians model
+class Parallel_TiledMOG2 : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_TiledMOG2(const cv::Mat* input, cv::Mat* foreground, vector< shared_ptr<cv::BackgroundSubtractorMOG2> >* subtractors,
+            const vector<cv::Rect>* tiles, float learningRate):
+            _input(input), _foreground(foreground), _subtractors(subtractors), _tiles(tiles), _learningRate(learningRate) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            for (int i = r.start; i < r.end; ++i)
+            {
+                // The tile of the foreground has the right size and type, so it is written in place
+                cv::Mat foreground = (*_foreground)((*_tiles)[i]);
+                (*(*_subtractors)[i])((*_input)((*_tiles)[i]), foreground, _learningRate);
+            }
+        }
+
+    private:
+        const cv::Mat* _input;
+        cv::Mat* _foreground;
+        vector< shared_ptr<cv::BackgroundSubtractorMOG2> >* _subtractors;
+        const vector<cv::Rect>* _tiles;
+        float _learningRate;
+};
+
+/*************/
+// Updates a running gaussian model for 8 bits images, and outputs the foreground
+class Parallel_RunningGaussian : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_RunningGaussian(const cv::Mat* input, cv::Mat* mean, cv::Mat* variance, cv::Mat* foreground, float alpha, float threshold):
+            _input(input), _mean(mean), _variance(variance), _foreground(foreground), _alpha(alpha), _threshold2(threshold * threshold) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const int channels = _input->channels();
+            const int length = _input->cols * channels;
+            vector<uchar> isForeground(length);
+
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const uchar* input = _input->ptr<uchar>(y);
+                float* mean = _mean->ptr<float>(y);
+                float* variance = _variance->ptr<float>(y);
+
+                int x = 0;
+#if CV_SSE2
+                const __m128i zero = _mm_setzero_si128();
+                const __m128 alpha = _mm_set1_ps(_alpha);
+                const __m128 threshold2 = _mm_set1_ps(_threshold2);
+                const __m128 minVariance = _mm_set1_ps(GAUSSIAN_MIN_VARIANCE);
+                for (; x + 4 <= length; x += 4)
+                {
+                    __m128i pixels = _mm_cvtsi32_si128(*(const int*)(input + x));
+                    pixels = _mm_unpacklo_epi16(_mm_unpacklo_epi8(pixels, zero), zero);
+                    __m128 values = _mm_cvtepi32_ps(pixels);
+
+                    __m128 m = _mm_loadu_ps(mean + x);
+                    __m128 v = _mm_loadu_ps(variance + x);
+                    __m128 d = _mm_sub_ps(values, m);
+                    __m128 d2 = _mm_mul_ps(d, d);
+
+                    int mask = _mm_movemask_ps(_mm_cmpgt_ps(d2, _mm_mul_ps(threshold2, v)));
+                    isForeground[x] = mask & 1;
+                    isForeground[x + 1] = (mask >> 1) & 1;
+                    isForeground[x + 2] = (mask >> 2) & 1;
+                    isForeground[x + 3] = (mask >> 3) & 1;
+
+                    m = _mm_add_ps(m, _mm_mul_ps(alpha, d));
+                    v = _mm_add_ps(v, _mm_mul_ps(alpha, _mm_sub_ps(d2, v)));
+                    _mm_storeu_ps(mean + x, m);
+                    _mm_storeu_ps(variance + x, _mm_max_ps(v, minVariance));
+                }
+#endif
+                for (; x < length; ++x)
+                {
+                    float d = (float)input[x] - mean[x];
+                    float d2 = d * d;
+                    isForeground[x] = d2 > _threshold2 * variance[x];
+                    mean[x] += _alpha * d;
+                    variance[x] = max(GAUSSIAN_MIN_VARIANCE, variance[x] + _alpha * (d2 - variance[x]));
+                }
+
+                // A pixel is foreground if any of its channels is
+                uchar* foreground = _foreground->ptr<uchar>(y);
+                for (int p = 0; p < _input->cols; ++p)
+                {
+                    uchar value = 0;
+                    for (int c = 0; c < channels; ++c)
+                        value |= isForeground[p * channels + c];
+                    foreground[p] = value ? 255 : 0;
+                }
+            }
+        }
+
+    private:
+        const cv::Mat* _input;
+        cv::Mat* _mean;
+        cv::Mat* _variance;
+        cv::Mat* _foreground;
+        float _alpha;
+        float _threshold2;
+};
+
+/*************/
+// Accumulates the color histogram of each labeled blob
+// Labels are converted to blob indices (starting from 1, 0 being ignored) through a lookup table
+class Parallel_LabelHistograms : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_LabelHistograms(const cv::Mat* input, const cv::Mat* labels, const vector<int>* blobIndices, vector< vector<float> >* histograms):
+            _input(input), _labels(labels), _blobIndices(blobIndices), _histograms(histograms)
+        {
+            _histogramSize = 1;
+            for (int c = 0; c < input->channels(); ++c)
+                _histogramSize *= HISTOGRAM_BINS;
+            _mutex.reset(new mutex());
+        }
+
+        void operator()(const cv::Range& r) const
+        {
+            const int channels = _input->channels();
+            const int labelNbr = _blobIndices->size();
+
+            // Local histograms are only allocated for the blobs present in this range
+            vector< vector<unsigned int> > histograms(_histograms->size());
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const int* labels = _labels->ptr<int>(y);
+                const uchar* pixels = _input->ptr<uchar>(y);
+                for (int x = 0; x < _labels->cols; ++x)
+                {
+                    int label = labels[x];
+                    if (label <= 0 || label >= labelNbr)
+                        continue;
+                    int index = (*_blobIndices)[label];
+                    if (index == 0)
+                        continue;
+
+                    vector<unsigned int>& histogram = histograms[index - 1];
+                    if (histogram.empty())
+                        histogram.resize(_histogramSize, 0);
+
+                    const uchar* pixel = pixels + x * channels;
+                    int bin = 0;
+                    for (int c = 0; c < channels; ++c)
+                        bin = bin * HISTOGRAM_BINS + (pixel[c] >> HISTOGRAM_SHIFT);
+                    histogram[bin]++;
+                }
+            }
+
+            lock_guard<mutex> lock(*_mutex.get());
+            for (unsigned int i = 0; i < histograms.size(); ++i)
+            {
+                if (histograms[i].empty())
+                    continue;
+                vector<float>& histogram = (*_histograms)[i];
+                if (histogram.empty())
+                    histogram.resize(_histogramSize, 0.f);
+                for (int b = 0; b < _histogramSize; ++b)
+                    histogram[b] += (float)histograms[i][b];
+            }
+        }
+
+    private:
+        const cv::Mat* _input;
+        const cv::Mat* _labels;
+        const vector<int>* _blobIndices;
+        vector< vector<float> >* _histograms;
+        int _histogramSize;
+        shared_ptr<mutex> _mutex;
+};
+
 /*************/
 // Definition of class Actuator_BgSubtractor
 /*************/
@@ -50,6 +234,125 @@ void Actuator_BgSubtractor::make()
     mLearningRate = 300;
     mMinArea = 0.f;
     mMaxArea = 65535.f;
+
+    mBgModel = mog2;
+    mBgTileNbr = 0;
+    mGaussianThreshold = 2.5f;
+    mGaussianFrames = 0;
+
+    mBgScale = 1.f;
+    mRefineThreshold = 16.f;
+}
+
+/*************/
+void Actuator_BgSubtractor::subtractBackground(const cv::Mat& pInput, cv::Mat& pForeground)
+{
+    pForeground.create(pInput.size(), CV_8U);
+
+    if (mBgModel == runningGaussian && pInput.depth() == CV_8U)
+    {
+        if (mGaussianMean.size() != pInput.size() || mGaussianMean.channels() != pInput.channels())
+        {
+            pInput.convertTo(mGaussianMean, CV_32F);
+            mGaussianVariance = cv::Mat(pInput.size(), mGaussianMean.type(), cv::Scalar::all(GAUSSIAN_INITIAL_VARIANCE));
+            mGaussianFrames = 0;
+        }
+
+        // Same automatic learning rate as MOG2 when the given one is not a valid rate
+        mGaussianFrames++;
+        float alpha = mLearningRate;
+        if (alpha < 0.f || alpha > 1.f)
+            alpha = 1.f / (float)min(2 * mGaussianFrames, 500);
+
+        cv::parallel_for_(cv::Range(0, pInput.rows), Parallel_RunningGaussian(&pInput, &mGaussianMean, &mGaussianVariance, &pForeground,
+            alpha, mGaussianThreshold));
+        return;
+    }
+
+    // Tiles are horizontal bands, and the models are created again if the frame size changes
+    int tileNbr = mBgTileNbr > 0 ? mBgTileNbr : max(1, cv::getNumberOfCPUs());
+    tileNbr = min(tileNbr, pInput.rows);
+    if (mBgTiles.size() != (size_t)tileNbr || mBgTiles.back().br() != cv::Point(pInput.cols, pInput.rows))
+    {
+        mBgTiles.clear();
+        mBgSubtractors.clear();
+        for (int i = 0; i < tileNbr; ++i)
+        {
+            int top = pInput.rows * i / tileNbr;
+            int bottom = pInput.rows * (i + 1) / tileNbr;
+            mBgTiles.push_back(cv::Rect(0, top, pInput.cols, bottom - top));
+            mBgSubtractors.push_back(shared_ptr<cv::BackgroundSubtractorMOG2>(new cv::BackgroundSubtractorMOG2()));
+        }
+    }
+
+    cv::parallel_for_(cv::Range(0, tileNbr), Parallel_TiledMOG2(&pInput, &pForeground, &mBgSubtractors, &mBgTiles, mLearningRate));
+}
+
+/*************/
+void Actuator_BgSubtractor::getBackgroundImage(const cv::Mat& pInput, cv::Mat& pBackground)
+{
+    if (mBgModel == runningGaussian && pInput.depth() == CV_8U)
+    {
+        mGaussianMean.convertTo(pBackground, CV_8U);
+        return;
+    }
+
+    pBackground.create(pInput.size(), pInput.type());
+    for (unsigned int i = 0; i < mBgTiles.size(); ++i)
+    {
+        cv::Mat tile;
+        mBgSubtractors[i]->getBackgroundImage(tile);
+        tile.copyTo(pBackground(mBgTiles[i]));
+    }
+}
+
+/*************/
+bool Actuator_BgSubtractor::refineBlob(const cv::Mat& pInput, const Component& pComponent, cv::Rect& pBox, float& pArea,
+    cv::Rect& pRoi, cv::Mat& pForeground)
+{
+    float invScale = 1.f / mBgScale;
+
+    // Full resolution region covered by the coarse blob, with a margin of one coarse pixel
+    cv::Rect coarseBox = pComponent.box;
+    coarseBox = cv::Rect(coarseBox.x - 1, coarseBox.y - 1, coarseBox.width + 2, coarseBox.height + 2) & cv::Rect(0, 0, mComponentLabels.cols, mComponentLabels.rows);
+    pRoi = cv::Rect((int)(coarseBox.x * invScale), (int)(coarseBox.y * invScale),
+        (int)ceilf(coarseBox.width * invScale), (int)ceilf(coarseBox.height * invScale)) & cv::Rect(0, 0, pInput.cols, pInput.rows);
+    if (pRoi.area() == 0)
+        return false;
+
+    // Upsampled component, so that neighbouring blobs are not merged
+    cv::Mat mask = mComponentLabels(coarseBox) == pComponent.label;
+    cv::resize(mask, pForeground, pRoi.size(), 0, 0, cv::INTER_NEAREST);
+    if (pInput.depth() != CV_8U)
+        return false;
+
+    // Pixels differing from the upsampled background
+    cv::Mat background, difference;
+    cv::resize(mBgImage(coarseBox), background, pRoi.size(), 0, 0, cv::INTER_LINEAR);
+    cv::absdiff(pInput(pRoi), background, difference);
+    if (difference.channels() > 1)
+    {
+        vector<cv::Mat> channels;
+        cv::split(difference, channels);
+        for (unsigned int c = 1; c < channels.size(); ++c)
+            cv::max(channels[0], channels[c], channels[0]);
+        difference = channels[0];
+    }
+
+    cv::Mat foreground;
+    cv::threshold(difference, foreground, mRefineThreshold, 255, cv::THRESH_BINARY);
+    cv::bitwise_and(foreground, pForeground, foreground);
+    cv::morphologyEx(foreground, foreground, cv::MORPH_OPEN, cv::Mat());
+
+    vector<cv::Point> points;
+    cv::findNonZero(foreground, points);
+    if (points.size() == 0)
+        return false;
+
+    pBox = cv::boundingRect(points) + pRoi.tl();
+    pArea = (float)points.size();
+    pForeground = foreground;
+    return true;
 }
 
 /*************/
@@ -64,7 +367,10 @@ atom::Message Actuator_BgSubtractor::detect(const vector< Capture_Ptr > pCapture
 
     // We get windows of interest, using BG subtraction
     // and previous blobs positions
-    mBgSubtractor(input, mBgSubtractorBuffer, mLearningRate);
+    cv::Mat bgInput = input;
+    if (mBgScale < 1.f)
+        cv::resize(input, bgInput, cv::Size(max(1, (int)(input.cols * mBgScale)), max(1, (int)(input.rows * mBgScale))), 0, 0, cv::INTER_AREA);
+    subtractBackground(bgInput, mBgSubtractorBuffer);
     
     // Info when learning should be done
     static int learnTimeElapsed = 0;
@@ -87,53 +393,64 @@ atom::Message Actuator_BgSubtractor::detect(const vector< Capture_Ptr > pCapture
         g_log(NULL, G_LOG_LEVEL_INFO, "%s: Background learning done", mClassName.c_str());
     }
 
-    // Erode and dilate to suppress noise
-    cv::Mat lEroded;
-    cv::erode(mBgSubtractorBuffer, lEroded, cv::Mat(), cv::Point(-1, -1), mFilterSize);
-    cv::dilate(lEroded, mBgSubtractorBuffer, cv::Mat(), cv::Point(-1, -1), mFilterSize * mFilterDilateCoeff);
-    cv::threshold(mBgSubtractorBuffer, mBgSubtractorBuffer, 250, 255, cv::THRESH_BINARY);
-
-    // Calculate the number of pixels detected as foreground
+    // Shadows are discarded, then we erode and dilate to suppress noise, all in a single pass.
+    // The filter size is given at full resolution
+    int filterSize = max(1, (int)roundf((float)mFilterSize * mBgScale));
+    unsigned long long foregroundPixels = thresholdMorphology(mBgSubtractorBuffer, 250, filterSize, filterSize * mFilterDilateCoeff, mForeground);
+    if ((float)foregroundPixels / (float)(mBgSubtractorBuffer.cols * mBgSubtractorBuffer.rows) > mMaxFGPortion)
     {
-        cv::Mat hist;
-        int histChannels[] = {0};
-        int histSize[] = {2};
-        float hRange[] = {0.f, 256.f};
-        const float* ranges[] = {hRange};
-        cv::calcHist(&mBgSubtractorBuffer, 1, histChannels, cv::Mat(), hist, 1, histSize, ranges, true, false);
-        if (hist.at<float>(1) / (float)(mBgSubtractorBuffer.cols * mBgSubtractorBuffer.rows) > mMaxFGPortion)
-        {
-            g_log(NULL, G_LOG_LEVEL_DEBUG, "%s: Too many pixels detected as foreground: no detection this round", mClassName.c_str());
-            return atom::Message();
-        }
+        g_log(NULL, G_LOG_LEVEL_DEBUG, "%s: Too many pixels detected as foreground: no detection this round", mClassName.c_str());
+        return atom::Message();
     }
 
-    vector< vector<cv::Point> > contours;
-    cv::Mat buffer = mBgSubtractorBuffer.clone();
-    cv::findContours(buffer, contours, CV_RETR_LIST, CV_CHAIN_APPROX_SIMPLE);
+    // Blobs are the connected components of the foreground. At full resolution, their label
+    // image is directly used for the color histograms
+    bool coarse = mBgScale < 1.f;
+    vector<Component> components = extractComponents(mForeground, coarse ? &mComponentLabels : &mLabels);
 
-    // Preparing some parameters for histogram creation
-    int channels[input.channels()];
-    int histSize[input.channels()];
-    float range[] = {0, 256};
-    const float* ranges[input.channels()];
-
-    for (int i = 0; i < input.channels(); ++i)
+    // Blobs from the downscaled frame are refined against the background image,
+    // and drawn at full resolution in the label image
+    if (coarse)
     {
-        channels[i] = i;
-        histSize[i] = 32;
-        ranges[i] = range;
+        if (input.depth() == CV_8U && components.size() > 0)
+            getBackgroundImage(bgInput, mBgImage);
+        mLabels.create(input.rows, input.cols, CV_32S);
+        mLabels.setTo(0);
     }
 
+    vector<int> blobIndices(components.size() + 1, 0);
     vector<Blob::properties> properties;
-    for (unsigned int i = 0; i < contours.size(); ++i)
+    for (auto& component : components)
     {
-        cv::Rect box = cv::boundingRect(contours[i]);
-        float area = cv::contourArea(contours[i], false);
+        cv::Rect box = component.box;
+        float area = (float)component.area / (mBgScale * mBgScale);
 
         if (area < mMinArea || area > mMaxArea)
             continue;
 
+        if (coarse)
+        {
+            cv::Rect refinedBox, roi;
+            cv::Mat foreground;
+            float refinedArea;
+            if (refineBlob(input, component, refinedBox, refinedArea, roi, foreground))
+            {
+                if (refinedArea < mMinArea || refinedArea > mMaxArea)
+                    continue;
+                box = refinedBox;
+                area = refinedArea;
+            }
+            else
+            {
+                // Nothing left after refinement, the coarse values are kept
+                box = cv::Rect((int)(box.x / mBgScale), (int)(box.y / mBgScale), (int)(box.width / mBgScale), (int)(box.height / mBgScale));
+                box &= cv::Rect(0, 0, input.cols, input.rows);
+            }
+
+            if (roi.area() > 0)
+                mLabels(roi).setTo(cv::Scalar(component.label), foreground);
+        }
+
         Blob::properties property;
         property.position.x = box.x + box.width / 2;
         property.position.y = box.y + box.height / 2;
@@ -141,12 +458,32 @@ atom::Message Actuator_BgSubtractor::detect(const vector< Capture_Ptr > pCapture
         property.speed.x = 0.f;
         property.speed.y = 0.f;
 
-        cv::Mat crop = cv::Mat(input, box);
-        cv::Mat hist;
-        cv::calcHist(&crop, 1, channels, cv::Mat(), hist, input.channels(), histSize, ranges, true, false);
-        property.colorHist = hist;
-
         properties.push_back(property);
+        blobIndices[component.label] = properties.size();
+    }
+
+    // Histograms of all blobs, in a single pass
+    cv::Mat histInput = input;
+    if (input.depth() != CV_8U)
+        input.convertTo(histInput, CV_8U);
+    vector< vector<float> > histograms(properties.size());
+    cv::parallel_for_(cv::Range(0, mLabels.rows), Parallel_LabelHistograms(&histInput, &mLabels, &blobIndices, &histograms),
+        cv::getNumberOfCPUs());
+
+    // Histograms have the same layout as the ones given by cv::calcHist
+    int histSize[] = {HISTOGRAM_BINS, HISTOGRAM_BINS, HISTOGRAM_BINS, HISTOGRAM_BINS};
+    for (unsigned int i = 0; i < properties.size(); ++i)
+    {
+        // A refined blob can be entirely covered by the ones drawn after it
+        if (histograms[i].empty())
+            histograms[i].resize((size_t)pow((double)HISTOGRAM_BINS, histInput.channels()), 0.f);
+
+        cv::Mat hist;
+        if (histInput.channels() == 1)
+            hist = cv::Mat(HISTOGRAM_BINS, 1, CV_32F, histograms[i].data());
+        else
+            hist = cv::Mat(histInput.channels(), histSize, CV_32F, histograms[i].data());
+        properties[i].colorHist = hist.clone();
     }
 
     // We want to track them
@@ -181,11 +518,11 @@ atom::Message Actuator_BgSubtractor::detect(const vector< Capture_Ptr > pCapture
     for_each (mBlobs.begin(), mBlobs.end(), [&] (Blob2DColor blob)
     {
         Blob::properties props = blob.getBlob();
-        cv::circle(resultMat, props.position, sqrtf(props.size), cv::Scalar(1, 1, 1), CV_FILLED);
+        cv::circle(resultMat, props.position, sqrtf(props.size), cv::Scalar(255, 255, 255), CV_FILLED);
     } );
 
     // The result is shown
-    cv::multiply(input, resultMat, resultMat);
+    maskImage(input, resultMat, resultMat);
 
     // Constructing the message
     mLastMessage.clear();
@@ -304,6 +641,36 @@ void Actuator_BgSubtractor::setParameter(atom::Message pMessage)
             mLearningTime = int(time);
         }
     }
+    else if (cmd == "model")
+    {
+        int model;
+        if (readParam(pMessage, model))
+            mBgModel = model == 1 ? runningGaussian : mog2;
+    }
+    else if (cmd == "tiles")
+    {
+        int tiles;
+        if (readParam(pMessage, tiles))
+            mBgTileNbr = max(0, tiles);
+    }
+    else if (cmd == "gaussianThreshold")
+    {
+        float threshold;
+        if (readParam(pMessage, threshold))
+            mGaussianThreshold = max(0.f, threshold);
+    }
+    else if (cmd == "bgScale")
+    {
+        float scale;
+        if (readParam(pMessage, scale))
+            mBgScale = min(1.f, max(0.05f, scale));
+    }
+    else if (cmd == "refineThreshold")
+    {
+        float threshold;
+        if (readParam(pMessage, threshold))
+            mRefineThreshold = max(0.f, threshold);
+    }
     else if (cmd == "area")
     {
        float mini, maxi;
@@ -25,6 +25,7 @@
 #ifndef BGSUBTRACTOR_H
 #define BGSUBTRACTOR_H
 
+#include <memory>
 #include <vector>
 
 #include "config.h"
@@ -66,17 +67,44 @@ class Actuator_BgSubtractor : public Actuator
         float mProcessNoiseCov, mMeasurementNoiseCov;
         float mMaxDistanceForColorDiff;
 
-        // Background subtractor, used to select window of interest
-        // to feed to the SVM
-        cv::BackgroundSubtractorMOG2 mBgSubtractor;
+        // Background models
+        enum BgModel
+        {
+            mog2 = 0, //!< Mixture of gaussians, from OpenCV
+            runningGaussian //!< One gaussian per pixel, lighter
+        };
+        int mBgModel;
+
+        // The mixture of gaussians model is split in horizontal tiles, updated in parallel
+        std::vector< std::shared_ptr<cv::BackgroundSubtractorMOG2> > mBgSubtractors;
+        std::vector<cv::Rect> mBgTiles;
+        int mBgTileNbr; //!< Number of tiles, 0 for one per CPU
+
+        // Running gaussian model
+        cv::Mat mGaussianMean, mGaussianVariance;
+        float mGaussianThreshold; //!< Distance to the mean, in standard deviations, above which a pixel is foreground
+        int mGaussianFrames;
+
+        // Coarse to fine detection: the background model and the morphology run on a downscaled frame,
+        // and only the blobs which survive the filtering are refined at full resolution
+        float mBgScale;
+        float mRefineThreshold; //!< Difference to the background above which a pixel is kept during refinement
+        cv::Mat mBgImage; //!< Background image at the scale of the model
 
         // Various variables
         cv::Mat mBgSubtractorBuffer;
+        BinaryMask mForeground; //!< Filtered foreground, at the scale of the background model
+        cv::Mat mLabels; //!< Blobs labels, at full resolution
+        cv::Mat mComponentLabels; //!< Blobs labels, at the scale of the background model
         float mLearningRate, mLearningTime;
         float mMinArea, mMaxArea;
 
         // Methods
         void make();
+        void subtractBackground(const cv::Mat& pInput, cv::Mat& pForeground);
+        void getBackgroundImage(const cv::Mat& pInput, cv::Mat& pBackground);
+        bool refineBlob(const cv::Mat& pInput, const Component& pComponent, cv::Rect& pBox, float& pArea,
+            cv::Rect& pRoi, cv::Mat& pForeground);
 };
 
 REGISTER_ACTUATOR(Actuator_BgSubtractor)
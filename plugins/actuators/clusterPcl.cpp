@@ -4,6 +4,8 @@ using namespace std;
 
 #if HAVE_PCL
 
+#include <algorithm>
+
 #include <pcl/point_cloud.h>
 #include <pcl/point_types.h>
 #include <pcl/segmentation/extract_clusters.h>
@@ -40,12 +42,12 @@ void Actuator_ClusterPcl::make()
 /*************/
 atom::Message Actuator_ClusterPcl::detect(vector<Capture_Ptr> pCaptures)
 {
-    vector< pcl::PointCloud<pcl::PointXYZRGBA>::Ptr > pointclouds;
+    vector<Capture_3D_PclRgba_Ptr> pointclouds;
     for_each (pCaptures.begin(), pCaptures.end(), [&] (Capture_Ptr capture)
     {
         Capture_3D_PclRgba_Ptr pcl = dynamic_pointer_cast<Capture_3D_PclRgba>(capture);
-        if (pcl.get() != NULL)
-            pointclouds.push_back(pcl->get());
+        if (pcl.get() != NULL && pcl->get().get() != NULL)
+            pointclouds.push_back(pcl);
     });
 
     if (pointclouds.size() == 0)
@@ -54,7 +56,7 @@ atom::Message Actuator_ClusterPcl::detect(vector<Capture_Ptr> pCaptures)
         return mLastMessage;
     }
 
-    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pcl = pointclouds[0];
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pcl = pointclouds[0]->get();
 
     if (pcl->points.size() == 0)
     {
@@ -64,17 +66,13 @@ atom::Message Actuator_ClusterPcl::detect(vector<Capture_Ptr> pCaptures)
 
     vector<pcl::PointXYZ> clusterPositions;
 
-    pcl::search::KdTree<pcl::PointXYZRGBA>::Ptr tree(new pcl::search::KdTree<pcl::PointXYZRGBA>());
-    tree->setInputCloud(pcl);
+    // The index is shared with the other actuators using the same capture. EuclideanClusterExtraction
+    // would set its input again, so the extraction function is called directly
+    pcl::search::Search<pcl::PointXYZRGBA>::Ptr tree = pointclouds[0]->getSearch();
 
     vector<pcl::PointIndices> cluster_indices;
-    pcl::EuclideanClusterExtraction<pcl::PointXYZRGBA> ec;
-    ec.setClusterTolerance(mClusterTolerance);
-    ec.setMinClusterSize(mMinClusterSize);
-    ec.setMaxClusterSize(mMaxClusterSize);
-    ec.setSearchMethod(tree);
-    ec.setInputCloud(pcl);
-    ec.extract(cluster_indices);
+    pcl::extractEuclideanClusters(*pcl, tree, mClusterTolerance, cluster_indices, mMinClusterSize, mMaxClusterSize);
+    sort(cluster_indices.rbegin(), cluster_indices.rend(), pcl::comparePointClusters);
 
     for_each (cluster_indices.begin(), cluster_indices.end(), [&] (pcl::PointIndices cluster)
     {
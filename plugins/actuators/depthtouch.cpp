@@ -109,31 +109,33 @@ atom::Message Actuator_DepthTouch::detect(const vector< Capture_Ptr > pCaptures)
     cv::Mat touch;
     cv::Mat touchDistance = cv::max((mBackgroundStddev + 1.0) * mSigmaCoeff, mDetectionDistance);
     cv::compare(distance, touchDistance, touch, cv::CMP_LE);
+    thresholdMorphology(touch, 0, 3, mFilterSize, touch);
     cv::Mat lEroded;
-    cv::erode(touch, lEroded, cv::Mat(), cv::Point(-1, -1), 3);
-    cv::dilate(lEroded, touch, cv::Mat(), cv::Point(-1, -1), mFilterSize);
 
-    vector< vector<cv::Point> > contours;
-    cv::Mat buffer = touch.clone();
-    cv::findContours(buffer, contours, CV_RETR_EXTERNAL, CV_CHAIN_APPROX_SIMPLE);
+    vector<Component> components = extractComponents(touch, NULL, true);
 
     vector<Property> properties;
-    for (unsigned int i = 0; i < contours.size(); ++i)
+    for (auto& component : components)
     {
-        cv::Rect box = cv::boundingRect(contours[i]);
-        float area = cv::contourArea(contours[i], false);
-
-        cv::Mat contourImg = cv::Mat::zeros(input.size(), CV_32F);
-        cv::drawContours(contourImg, contours, i, cv::Scalar(1.f), CV_FILLED);
+        cv::Rect box = component.box;
+        float area = (float)component.area;
+
+        // The component is eroded in a region slightly larger than its box,
+        // so that its borders are eroded as if the whole frame was processed
+        cv::Rect margin = cv::Rect(box.x - mFilterSize, box.y - mFilterSize, box.width + 2 * mFilterSize, box.height + 2 * mFilterSize)
+            & cv::Rect(0, 0, input.cols, input.rows);
+        // The external contour is filled, so that holes in the component are eroded as part of it
+        cv::Mat contourImg = cv::Mat::zeros(margin.height, margin.width, CV_32F);
+        vector<vector<cv::Point>> contours(1, component.contour);
+        cv::drawContours(contourImg, contours, 0, cv::Scalar(1.f), CV_FILLED, 8, cv::noArray(), INT_MAX, -margin.tl());
         cv::erode(contourImg, lEroded, cv::Mat(), cv::Point(-1, -1), mFilterSize);
-        contourImg = lEroded;
-        cv::Mat inverseContour = cv::Mat::zeros(input.size(), CV_32F);
-        inverseContour = (1.f - contourImg) * MAX_DEPTH;
-        contourImg = cv::max(contourImg.mul(distance), inverseContour);
+        contourImg = lEroded(cv::Rect(box.x - margin.x, box.y - margin.y, box.width, box.height));
+        cv::Mat inverseContour = (1.f - contourImg) * MAX_DEPTH;
+        contourImg = cv::max(contourImg.mul(distance(box)), inverseContour);
 
         // We are looking for the extremity of the hand (ideally, the fingers)
         // So we search the part of the contour which is the nearest to the surface
-        cv::Mat roi = contourImg(box);
+        cv::Mat roi = contourImg;
         float contourMin = MAX_DEPTH;
         float contourMax = 0.f;
         for (unsigned int x = 0; x < roi.cols; ++x)
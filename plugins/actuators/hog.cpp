@@ -2,35 +2,74 @@
 
 #include <cmath>
 #include <chrono>
+#include <cstring>
 #include <memory>
-#include <mutex>
 #include <thread>
 #include <utility>
 
 using namespace std;
 using namespace chrono;
 
+// Number of windows evaluated per thread in each chunk
+#define DETECTION_WINDOWS_PER_THREAD 64
+// Number of interleaved sub-grids used to order the scanned windows
+#define SCAN_LEVELS 4
+
 /*****************/
-// Class for parallel detection
+// Class for parallel computation of the descriptors of a batch,
+// each one being written to its row of the batch matrix
 /*****************/
-class Parallel_Detect : public cv::ParallelLoopBody
+class Parallel_Describe : public cv::ParallelLoopBody
 {
     public:
-        Parallel_Detect(const vector<cv::Point>* points, vector<cv::Point>* samples, const float margin,
-            const Descriptor_Hog* descriptor, const CvSVM* svm, const cv::PCA* pca):
-            _points(points), _samples(samples), _margin(margin), _descriptor(descriptor), _svm(svm), _pca(pca)
+        Parallel_Describe(const vector<Hog_Window>* windows, cv::Mat* descriptions, vector<uchar>* valid, const vector<Descriptor_Hog>* descriptors):
+            _windows(windows), _descriptions(descriptions), _valid(valid), _descriptors(descriptors) {}
+
+        void operator()(const cv::Range& r) const
         {
-            mMutex.reset(new mutex());
+            vector<float> description;
+            for (int idx = r.start; idx < r.end; ++idx)
+            {
+                const Hog_Window& window = (*_windows)[idx];
+                description = (*_descriptors)[window.level].getDescriptor(window.position);
+                if ((int)description.size() != _descriptions->cols)
+                {
+                    (*_valid)[idx] = 0;
+                    continue;
+                }
+
+                memcpy(_descriptions->ptr<float>(idx), description.data(), description.size() * sizeof(float));
+                (*_valid)[idx] = 1;
+            }
         }
 
+    private:
+        const vector<Hog_Window>* _windows;
+        cv::Mat* _descriptions;
+        vector<uchar>* _valid;
+        const vector<Descriptor_Hog>* _descriptors;
+};
+
+/*****************/
+// Class for parallel detection, for models which can not be collapsed
+/*****************/
+class Parallel_Detect : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Detect(const vector<Hog_Window>* windows, vector<uchar>* positives, const float margin,
+            const vector<Descriptor_Hog>* descriptors, const CvSVM* svm, const cv::PCA* pca):
+            _windows(windows), _positives(positives), _margin(margin), _descriptors(descriptors), _svm(svm), _pca(pca) {}
+
         void operator()(const cv::Range& r) const
         {
             vector<float> description;
             cv::Mat descriptionMat;
             for (int idx = r.start; idx < r.end; ++idx)
             {
-                const cv::Point point = (*_points)[idx];
-                description = _descriptor->getDescriptor(point);
+                (*_positives)[idx] = 0;
+
+                const Hog_Window& window = (*_windows)[idx];
+                description = (*_descriptors)[window.level].getDescriptor(window.position);
                 if (description.size() == 0)
                     continue;
                 descriptionMat = cv::Mat(1, description.size(), CV_32FC1, &description[0]);
@@ -40,54 +79,77 @@ class Parallel_Detect : public cv::ParallelLoopBody
                 
                 descriptionMat = descriptionMat.t();
 
-                if (_margin > 0.f)
+                float distance;
+                try
                 {
-                    float distance;
-                    try
-                    {
-                        distance = _svm->predict(descriptionMat, true);
-                    }
-                    catch (cv::Exception)
-                    {
-                        g_log(NULL, G_LOG_LEVEL_ERROR, "%s - An exception happened during a call to CvSVM::predict. Is the model file correct?", Actuator_Hog::getClassName().c_str());
-                    }
-                    if (distance < -_margin)
-                    {
-                        lock_guard<mutex> lock(*mMutex.get());
-                        _samples->push_back(point);
-                    }
+                    distance = _svm->predict(descriptionMat, _margin > 0.f);
                 }
-                else
+                catch (cv::Exception)
                 {
-                    float distance;
-                    try
-                    {
-                        distance = _svm->predict(descriptionMat, false);
-                    }
-                    catch (cv::Exception)
-                    {
-                        g_log(NULL, G_LOG_LEVEL_ERROR, "%s - An exception happened during a call to CvSVM::predict. Is the model file correct?", Actuator_Hog::getClassName().c_str());
-                    }
-                    if (distance == 1.f)
-                    {
-                        lock_guard<mutex> lock(*mMutex.get());
-                        _samples->push_back(point);
-                    }
+                    g_log(NULL, G_LOG_LEVEL_ERROR, "%s - An exception happened during a call to CvSVM::predict. Is the model file correct?", Actuator_Hog::getClassName().c_str());
+                    continue;
                 }
+
+                if ((_margin > 0.f && distance < -_margin) || (_margin <= 0.f && distance == 1.f))
+                    (*_positives)[idx] = 1;
             }
         }
 
     private:
-        const vector<cv::Point>* _points;
-        vector<cv::Point>* _samples;
-        const Descriptor_Hog* _descriptor;
+        const vector<Hog_Window>* _windows;
+        vector<uchar>* _positives;
+        const vector<Descriptor_Hog>* _descriptors;
         const CvSVM* _svm;
         const cv::PCA* _pca;
         const float _margin;
-
-        shared_ptr<mutex> mMutex;
 };
 
+/*************/
+// Scales a rectangle from the input image to a level of the pyramid
+static cv::Rect scaleRect(const cv::Rect& rect, const float scale)
+{
+    return cv::Rect(cvRound(rect.x / scale), cvRound(rect.y / scale), cvRound(rect.width / scale), cvRound(rect.height / scale));
+}
+
+/*************/
+// Definition of class Hog_Svm
+/*************/
+bool Hog_Svm::getLinearModel(cv::Mat& pWeights, double& pBias) const
+{
+    if (decision_func == NULL || get_support_vector_count() == 0)
+        return false;
+    if (params.kernel_type != CvSVM::LINEAR || (params.svm_type != CvSVM::C_SVC && params.svm_type != CvSVM::NU_SVC))
+        return false;
+    // With labels (-1, 1), the first one is predicted when the decision value is positive
+    if (class_count != 2 || class_labels == NULL || class_labels->data.i[0] != -1 || class_labels->data.i[1] != 1)
+        return false;
+
+    const CvSVMDecisionFunc* df = (const CvSVMDecisionFunc*)decision_func;
+    const int varCount = get_var_count();
+
+    cv::Mat weights = cv::Mat::zeros(1, varCount, CV_64F);
+    for (int k = 0; k < df->sv_count; ++k)
+    {
+        const float* supportVector = get_support_vector(df->sv_index != NULL ? df->sv_index[k] : k);
+        double* w = weights.ptr<double>(0);
+        for (int i = 0; i < varCount; ++i)
+            w[i] += df->alpha[k] * supportVector[i];
+    }
+
+    // The model may have been trained on a subset of the variables
+    if (var_idx != NULL)
+    {
+        pWeights = cv::Mat::zeros(1, var_all, CV_64F);
+        for (int i = 0; i < varCount; ++i)
+            pWeights.at<double>(0, var_idx->data.i[i]) = weights.at<double>(0, i);
+    }
+    else
+        pWeights = weights;
+
+    pBias = -df->rho;
+    return true;
+}
+
 /*************/
 // Definition of class Actuator_Hog
 /*************/
@@ -132,14 +194,20 @@ void Actuator_Hog::make()
     mCellStep = cv::Size_<float>(2.f, 2.f);
     mBins = 9;
     mSigma = 0.f;
+    mPyramidLevels = 1;
+    mPyramidScale = 1.2f;
+    mPyramidMinScale = 1.f;
     updateDescriptorParams();
 
     mIsPcaLoaded = false;
 
     mSvmMargin = 0.f;
     mIsModelLoaded = false;
+    mIsSvmLinear = false;
+    mSvmBias = 0.f;
     mMaxTimePerFrame = 1e5;
     mMaxThreads = 4;
+    mScanStride = 1;
 
     mBlobMergeDistance = 64.f;
     mSaveSamples = false;
@@ -179,60 +247,101 @@ atom::Message Actuator_Hog::detect(const vector< Capture_Ptr > pCaptures)
     }
     else
         mBgSubtractor(input, mBgSubtractorBuffer);
-    // Erode and dilate to suppress noise
-    cv::Mat lEroded;
-    cv::threshold(mBgSubtractorBuffer, mBgSubtractorBuffer, 250, 255, cv::THRESH_BINARY);
-    cv::erode(mBgSubtractorBuffer, lEroded, cv::Mat(), cv::Point(-1, -1), mFilterSize);
-
-    mBgSubtractorBuffer = cv::Mat::zeros(mBgSubtractorBuffer.size(), CV_8U);
-    for (uint x = 0; x < lEroded.cols; ++x)
-        for (uint y = 0; y < lEroded.rows; ++y)
-        {
-            if (lEroded.at<uchar>(y, x) > 0)
-            {
-                cv::Rect rect(x - mRoiSize.width / 2, y - mRoiSize.height / 2, mRoiSize.width, mRoiSize.height);
-                cv::rectangle(mBgSubtractorBuffer, rect, 255, CV_FILLED);
-                cv::rectangle(lEroded, rect, 0, CV_FILLED);
-            }
-        }
+    // Discard shadows and erode to suppress noise
+    thresholdMorphology(mBgSubtractorBuffer, 250, mFilterSize, 0, mForeground);
+    vector<Component> components = extractComponents(mForeground);
 
-    // We draw rectangles to handle previously detected blobs
-    // except for the inner part which we will handle in priority
-    cv::Mat priorityMat = cv::Mat::zeros(mBgSubtractorBuffer.size(), CV_8U);
-    for (auto& blob : mBlobs)
+    // The levels of the pyramid are scaled versions of the input, from mPyramidMinScale and as long as a detection window fits in them.
+    // Levels with a scale below 1 are upscaled, so that objects smaller than the detection window are detected too
+    vector<float> scales(1, mPyramidMinScale);
+    for (int level = 1; level < mPyramidLevels; ++level)
     {
-        Blob::properties props = blob.getBlob();
-        cv::Rect rect(props.position.x - props.size/2, props.position.y - props.size/2, props.size, props.size);
-        cv::rectangle(mBgSubtractorBuffer, rect, 255, CV_FILLED);
+        float scale = mPyramidMinScale * pow(mPyramidScale, (float)level);
+        if ((float)input.cols / scale < mRoiSize.width || (float)input.rows / scale < mRoiSize.height)
+            break;
+        scales.push_back(scale);
+    }
 
-        rect = cv::Rect(props.position.x - props.size/4, props.position.y - props.size/4, props.size/2, props.size/2);
-        cv::rectangle(mBgSubtractorBuffer, rect, 0, CV_FILLED);
-        cv::rectangle(priorityMat, rect, 255, CV_FILLED);
+    // Previously detected blobs are handled in priority, at the level closest to their size
+    vector<int> blobLevels;
+    for (auto& blob : mBlobs)
+    {
+        float blobScale = max(scales[0], blob.getBlob().size / (float)mRoiSize.width);
+        int blobLevel = 0;
+        for (int level = 1; level < scales.size(); ++level)
+            if (abs(log(blobScale / scales[level])) < abs(log(blobScale / scales[blobLevel])))
+                blobLevel = level;
+        blobLevels.push_back(blobLevel);
     }
 
-    // The result is resized according to cell size
-    cv::Size outputSize;
-    outputSize.width = mBgSubtractorBuffer.cols / mCellSize.width;
-    outputSize.height = mBgSubtractorBuffer.rows / mCellSize.height;
-    cv::Mat resizedBuffer;
-    cv::resize(mBgSubtractorBuffer, resizedBuffer, outputSize, 0, 0, cv::INTER_NEAREST);
+    vector<cv::Mat> bgMasks(scales.size());
+    vector<cv::Mat> priorityMasks(scales.size());
+    for (int level = 0; level < scales.size(); ++level)
+    {
+        const float scale = scales[level];
+        cv::Mat levelInput = input;
+        if (scale != 1.f)
+            cv::resize(input, levelInput, cv::Size(cvRound(input.cols / scale), cvRound(input.rows / scale)), 0, 0,
+                       scale > 1.f ? cv::INTER_AREA : cv::INTER_LINEAR);
+
+        // Windows of interest cover each foreground blob, with a margin of half the detection window
+        cv::Mat bgMask = cv::Mat::zeros(levelInput.size(), CV_8U);
+        for (auto& component : components)
+        {
+            cv::Rect box = scaleRect(component.box, scale);
+            cv::Rect rect(box.x - mRoiSize.width / 2, box.y - mRoiSize.height / 2,
+                          box.width + mRoiSize.width, box.height + mRoiSize.height);
+            cv::rectangle(bgMask, rect, 255, CV_FILLED);
+        }
 
-    // Same for priorityMat
-    cv::Mat resizedPriority;
-    cv::resize(priorityMat, resizedPriority, outputSize, 0, 0, cv::INTER_NEAREST);
+        // We draw rectangles to handle previously detected blobs
+        // except for the inner part which we will handle in priority
+        cv::Mat priorityMat = cv::Mat::zeros(levelInput.size(), CV_8U);
+        for (int i = 0; i < mBlobs.size(); ++i)
+        {
+            if (blobLevels[i] != level)
+                continue;
 
-    // We feed the image to the descriptor
-    mDescriptor.setImage(input);
+            Blob::properties props = mBlobs[i].getBlob();
+            cv::Rect rect(props.position.x - props.size/2, props.position.y - props.size/2, props.size, props.size);
+            cv::rectangle(bgMask, scaleRect(rect, scale), 255, CV_FILLED);
 
-    // We fill the vector of all positions to test
-    if (mSvmValidPositions.capacity() != outputSize.width * outputSize.height)
-        mSvmValidPositions.reserve(outputSize.width * outputSize.height);
+            rect = cv::Rect(props.position.x - props.size/4, props.position.y - props.size/4, props.size/2, props.size/2);
+            cv::rectangle(bgMask, scaleRect(rect, scale), 0, CV_FILLED);
+            cv::rectangle(priorityMat, scaleRect(rect, scale), 255, CV_FILLED);
+        }
 
-    vector<cv::Point> samples;
+        if (level == 0 && scale == 1.f)
+            mBgSubtractorBuffer = bgMask;
+        else if (level == 0)
+            cv::resize(bgMask, mBgSubtractorBuffer, input.size(), 0, 0, cv::INTER_NEAREST);
+
+        // The masks are resized according to cell size
+        cv::Size outputSize;
+        outputSize.width = levelInput.cols / mCellSize.width;
+        outputSize.height = levelInput.rows / mCellSize.height;
+        cv::resize(bgMask, bgMasks[level], outputSize, 0, 0, cv::INTER_NEAREST);
+        cv::resize(priorityMat, priorityMasks[level], outputSize, 0, 0, cv::INTER_NEAREST);
+
+        // We feed the image to the descriptor of this level
+        mDescriptors[level].setImage(levelInput);
+    }
+
+    vector<Hog_Window> windows;
     // Detection through previous known positions
-    detectThroughMask(resizedPriority, samples, false);
+    detectThroughMask(priorityMasks, windows, false);
     // Detection through positions given by the BG subtractor
-    detectThroughMask(resizedBuffer, samples, true);
+    detectThroughMask(bgMasks, windows, true);
+
+    // Detections from all levels are compared through the centers of their windows, in the input image
+    vector<cv::Point> samples;
+    vector<float> sampleScales;
+    for (auto& window : windows)
+    {
+        const float scale = scales[window.level];
+        samples.push_back(cv::Point((int)((window.position.x + mRoiSize.width / 2) * scale), (int)((window.position.y + mRoiSize.height / 2) * scale)));
+        sampleScales.push_back(scale);
+    }
 
     // A single object can be detected by multiple windows.
     // We need to merge them
@@ -242,14 +351,15 @@ atom::Message Actuator_Hog::detect(const vector< Capture_Ptr > pCaptures)
         for (int j = i + 1; j < samples.size();)
         {
             float distance = sqrtf(pow(samples[i].x - samples[j].x, 2.f) + pow(samples[i].y - samples[j].y, 2.f));
-            if (distance < mBlobMergeDistance)
+            if (distance < mBlobMergeDistance * max(sampleScales[i], sampleScales[j]))
             {
                 meanFactor++;
                 samples[i].x = (int)((float)samples[i].x * (meanFactor - 1.f)/meanFactor + (float)samples[j].x * 1.f / meanFactor);
                 samples[i].y = (int)((float)samples[i].y * (meanFactor - 1.f)/meanFactor + (float)samples[j].y * 1.f / meanFactor);
+                sampleScales[i] = sampleScales[i] * (meanFactor - 1.f)/meanFactor + sampleScales[j] / meanFactor;
 
-                vector<cv::Point>::iterator it = samples.begin() + j;
-                samples.erase(it);
+                samples.erase(samples.begin() + j);
+                sampleScales.erase(sampleScales.begin() + j);
             }
             else
                 j++;
@@ -257,13 +367,14 @@ atom::Message Actuator_Hog::detect(const vector< Capture_Ptr > pCaptures)
     }
 
     // We create the properties which will be converted to blobs
+    // Their position is the top left corner of the detection window, as seen from the input image
     vector<Blob::properties> properties;
     for (int i = 0; i < samples.size(); ++i)
     {
         Blob::properties property;
-        property.position.x = samples[i].x;
-        property.position.y = samples[i].y;
-        property.size = mRoiSize.width;
+        property.position.x = samples[i].x - (int)(mRoiSize.width / 2 * sampleScales[i]);
+        property.position.y = samples[i].y - (int)(mRoiSize.height / 2 * sampleScales[i]);
+        property.size = mRoiSize.width * sampleScales[i];
         property.speed.x = 0.f;
         property.speed.y = 0.f;
 
@@ -292,25 +403,26 @@ atom::Message Actuator_Hog::detect(const vector< Capture_Ptr > pCaptures)
     for (auto& blob : mBlobs)
     {
         Blob::properties props = blob.getBlob();
-        // We draw a rectangle of visibility around the detected blobs
-        cv::Rect rect(props.position.x, props.position.y, mRoiSize.width, mRoiSize.height);
+        // We draw a rectangle of visibility around the detected blobs, at the scale they were detected
+        float scale = props.size / (float)mRoiSize.width;
+        cv::Rect rect(props.position.x, props.position.y, mRoiSize.width * scale, mRoiSize.height * scale);
         if (blob.getAge() > mKeepOldBlobs)
-            cv::rectangle(resultMat, rect, cv::Scalar(1, 1, 1), CV_FILLED);
+            cv::rectangle(resultMat, rect, cv::Scalar(255, 255, 255), CV_FILLED);
         else
-            cv::rectangle(resultMat, rect, cv::Scalar(1, 1, 0), CV_FILLED);
+            cv::rectangle(resultMat, rect, cv::Scalar(255, 255, 0), CV_FILLED);
 
         if (mSaveSamples && blob.getAge() == mSaveSamplesAge
             && rect.x >= 0 && rect.y >= 0 && input.cols - rect.width > rect.x && input.rows - rect.height > rect.y)
         {
             cv::Mat cropSample(input, rect);
             char buffer[64];
-            sprintf(buffer, "sample_%i.png", blob.getId());
-            cv::imwrite(buffer, cropSample);
+            sprintf(buffer, "sample_%i", blob.getId());
+            mSamplesWriter->write(cropSample, buffer);
         }
     }
 
     // The result is shown
-    cv::multiply(input, resultMat, resultMat);
+    maskImage(input, resultMat, resultMat);
 
 
     // Constructing the message
@@ -360,53 +472,97 @@ atom::Message Actuator_Hog::detect(const vector< Capture_Ptr > pCaptures)
 }
 
 /*************/
-void Actuator_Hog::detectThroughMask(cv::Mat& mask, vector<cv::Point>& samples, bool timeLimited)
+void Actuator_Hog::detectThroughMask(vector<cv::Mat>& masks, vector<Hog_Window>& samples, bool timeLimited)
 {
-    int validPositions = 0;
-    for (int x = 0; x < mask.cols; ++x)
-        for (int y = 0; y < mask.rows; ++y)
+    // Windows are taken inside the masks of all levels, every mScanStride cells. They are ordered from the coarsest
+    // sub-grid to the finest, so that a scan stopped by the time limit is still spread over the whole masks
+    vector<Hog_Window> subGrids[SCAN_LEVELS];
+    for (int level = 0; level < masks.size(); ++level)
+    {
+        const cv::Mat& mask = masks[level];
+        for (int y = 0; y < mask.rows; y += mScanStride)
+        {
+            const uchar* maskRow = mask.ptr<uchar>(y);
+            for (int x = 0; x < mask.cols; x += mScanStride)
             {
-                if (mask.at<uchar>(y, x) < 255)
+                if (maskRow[x] < 255)
                     continue;
 
-                vector<cv::Point>::iterator it = mSvmValidPositions.begin() + validPositions;
-                *it = cv::Point(x, y);
-                validPositions++;
+                int gridPos = (x / mScanStride) | (y / mScanStride);
+                int subGrid = 0;
+                while (subGrid < SCAN_LEVELS - 1 && (gridPos & ((2 << subGrid) - 1)) == 0)
+                    subGrid++;
+
+                Hog_Window window;
+                window.position = cv::Point(x * mCellSize.width, y * mCellSize.height);
+                window.level = level;
+                subGrids[SCAN_LEVELS - 1 - subGrid].push_back(window);
             }
-    int totalSamples = validPositions;
+        }
+    }
+
+    mSvmValidPositions.clear();
+    for (int i = 0; i < SCAN_LEVELS; ++i)
+        mSvmValidPositions.insert(mSvmValidPositions.end(), subGrids[i].begin(), subGrids[i].end());
+    const int totalWindows = mSvmValidPositions.size();
+
+    // Windows are evaluated by large chunks spread over the threads, the time limit being checked between them
+    const int chunkSize = mMaxThreads * DETECTION_WINDOWS_PER_THREAD;
+    vector<Hog_Window> points;
+    int evaluatedWindows = 0;
 
     unsigned long long timePresent = duration_cast<microseconds>(high_resolution_clock::now().time_since_epoch()).count();
-    while (validPositions && (timePresent - mTimeStart < mMaxTimePerFrame || !timeLimited))
+    while (evaluatedWindows < totalWindows && (timePresent - mTimeStart < mMaxTimePerFrame || !timeLimited))
+    {
+        int nbrPoints = min(chunkSize, totalWindows - evaluatedWindows);
+        points.assign(mSvmValidPositions.begin() + evaluatedWindows, mSvmValidPositions.begin() + evaluatedWindows + nbrPoints);
+        evaluateWindows(points, samples);
+        evaluatedWindows += nbrPoints;
+
+        timePresent = duration_cast<microseconds>(high_resolution_clock::now().time_since_epoch()).count();
+    }
+
+    if (mVerbose && totalWindows != 0)
+        g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - %s scan: evaluated %i out of %i windows, coverage = %f", mClassName.c_str(),
+              timeLimited ? "Background" : "Priority", evaluatedWindows, totalWindows, (float)evaluatedWindows / (float)totalWindows);
+}
+
+/*************/
+void Actuator_Hog::evaluateWindows(const vector<Hog_Window>& points, vector<Hog_Window>& samples)
+{
+    const int nbrPoints = points.size();
+    // Each window has its own result slot, no need to lock anything
+    vector<uchar> positives(nbrPoints, 0);
+
+    if (mIsSvmLinear)
     {
-        vector<cv::Point> points;
-        int nbrPoints = min(mMaxThreads, validPositions);
+        // Descriptors are gathered in a matrix, and scored all at once
+        cv::Mat descriptions(nbrPoints, mSvmWeights.rows, CV_32F);
+        cv::parallel_for_(cv::Range(0, nbrPoints), Parallel_Describe(&points, &descriptions, &positives, &mDescriptors), mMaxThreads);
+
+        cv::Mat scores = descriptions * mSvmWeights;
         for (int i = 0; i < nbrPoints; ++i)
         {
-            unsigned int random = mRng();
-            unsigned int position = random % validPositions;
-            vector<cv::Point>::iterator it = mSvmValidPositions.begin() + position;
-            cv::Point point = *it;
-            vector<cv::Point>::iterator lastIt = mSvmValidPositions.begin() + validPositions - 1;
-            swap(*lastIt, *it);
-
-            point.x *= mCellSize.width;
-            point.y *= mCellSize.height;
-
-            validPositions--;
-            points.push_back(point);
-        }
-
+            if (!positives[i])
+                continue;
 
+            // Same decision as CvSVM::predict, the positive label being predicted for negative values
+            float distance = scores.at<float>(i, 0) + mSvmBias;
+            if ((mSvmMargin > 0.f && distance < -mSvmMargin) || (mSvmMargin <= 0.f && distance <= 0.f))
+                samples.push_back(points[i]);
+        }
+    }
+    else
+    {
         if (mIsPcaLoaded)
-            cv::parallel_for_(cv::Range(0, nbrPoints), Parallel_Detect(&points, &samples, mSvmMargin, &mDescriptor, &mSvm, &mPca));
+            cv::parallel_for_(cv::Range(0, nbrPoints), Parallel_Detect(&points, &positives, mSvmMargin, &mDescriptors, &mSvm, &mPca), mMaxThreads);
         else
-            cv::parallel_for_(cv::Range(0, nbrPoints), Parallel_Detect(&points, &samples, mSvmMargin, &mDescriptor, &mSvm, NULL));
+            cv::parallel_for_(cv::Range(0, nbrPoints), Parallel_Detect(&points, &positives, mSvmMargin, &mDescriptors, &mSvm, NULL), mMaxThreads);
 
-        timePresent = duration_cast<microseconds>(high_resolution_clock::now().time_since_epoch()).count();
+        for (int i = 0; i < nbrPoints; ++i)
+            if (positives[i])
+                samples.push_back(points[i]);
     }
-
-    if (timeLimited && mVerbose && totalSamples != 0)
-        g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - Evaluated ratio = %f", mClassName.c_str(), 1.f - (float)validPositions / (float)totalSamples);
 }
 
 /*************/
@@ -443,6 +599,7 @@ void Actuator_Hog::setParameter(atom::Message pMessage)
         g_log(NULL, G_LOG_LEVEL_INFO, "%s - Attempting to load SVM model from file %s", mClassName.c_str(), filename.c_str());
         mSvm.load(filename.c_str());
         mIsModelLoaded = true;
+        updateLinearModel();
     }
     else if (cmd == "pcaFilename")
     {
@@ -458,6 +615,7 @@ void Actuator_Hog::setParameter(atom::Message pMessage)
         mPca.eigenvectors = eigen;
         mPca.mean = mean;
         mIsPcaLoaded = true;
+        updateLinearModel();
     }
     else if (cmd == "maxTimePerFrame")
     {
@@ -471,6 +629,12 @@ void Actuator_Hog::setParameter(atom::Message pMessage)
         if (readParam(pMessage, nbr))
             mMaxThreads = max(1, (int)nbr);
     }
+    else if (cmd == "scanStride")
+    {
+        float stride;
+        if (readParam(pMessage, stride))
+            mScanStride = max(1, (int)stride);
+    }
     else if (cmd == "mergeDistance")
     {
         float distance;
@@ -570,6 +734,27 @@ void Actuator_Hog::setParameter(atom::Message pMessage)
         mBins = max(2.f, bins);
         updateDescriptorParams();
     }
+    else if (cmd == "pyramidLevels")
+    {
+        float levels;
+        if (!readParam<float>(pMessage, levels))
+            return;
+
+        mPyramidLevels = max(1, (int)levels);
+        updateDescriptorParams();
+    }
+    else if (cmd == "pyramidScale")
+    {
+        float scale;
+        if (readParam<float>(pMessage, scale))
+            mPyramidScale = max(1.05f, scale);
+    }
+    else if (cmd == "pyramidMinScale")
+    {
+        float scale;
+        if (readParam<float>(pMessage, scale))
+            mPyramidMinScale = min(1.f, max(0.25f, scale));
+    }
     else if (cmd == "margin")
     {
         float margin;
@@ -611,10 +796,26 @@ void Actuator_Hog::setParameter(atom::Message pMessage)
             return;
 
         if (save == 1.f)
+        {
+            if (mSamplesWriter.get() == NULL)
+                mSamplesWriter.reset(new FrameWriter());
             mSaveSamples = true;
+        }
         else
             mSaveSamples = false;
     }
+    else if (cmd == "saveSamplesFormat")
+    {
+        string extension;
+        if (!readParam(pMessage, extension))
+            return;
+        int compression = -1;
+        readParam(pMessage, compression, 2);
+
+        if (mSamplesWriter.get() == NULL)
+            mSamplesWriter.reset(new FrameWriter());
+        mSamplesWriter->setFormat(extension, compression);
+    }
     else if (cmd == "saveSamplesAge")
     {
         float age;
@@ -628,7 +829,48 @@ void Actuator_Hog::setParameter(atom::Message pMessage)
 /*************/
 void Actuator_Hog::updateDescriptorParams()
 {
-    mDescriptor.setHogParams(mRoiSize, mBlockSize, mCellSize, mBins, false, Descriptor_Hog::L2_NORM, mSigma);
-    if (mCellMaxSize.width >= mCellSize.width && mCellMaxSize.height >= mCellSize.height && mCellStep.width >= 1.f && mCellStep.height >= 1.f)
-        mDescriptor.setMultiscaleParams(mCellSize, mCellMaxSize, mCellStep);
+    // All the levels of the pyramid share the same parameters
+    mDescriptors.resize(mPyramidLevels);
+    for (auto& descriptor : mDescriptors)
+    {
+        descriptor.setHogParams(mRoiSize, mBlockSize, mCellSize, mBins, false, Descriptor_Hog::L2_NORM, mSigma);
+        if (mCellMaxSize.width >= mCellSize.width && mCellMaxSize.height >= mCellSize.height && mCellStep.width >= 1.f && mCellStep.height >= 1.f)
+            descriptor.setMultiscaleParams(mCellSize, mCellMaxSize, mCellStep);
+    }
+}
+
+/*************/
+void Actuator_Hog::updateLinearModel()
+{
+    mIsSvmLinear = false;
+    if (!mIsModelLoaded)
+        return;
+
+    cv::Mat weights;
+    double bias;
+    if (!mSvm.getLinearModel(weights, bias))
+    {
+        g_log(NULL, G_LOG_LEVEL_INFO, "%s - SVM model is not linear, windows will be evaluated one by one", mClassName.c_str());
+        return;
+    }
+
+    // The PCA projection is folded into the weights: w.(E.(x - mean)) = (E^t.w).x - (E^t.w).mean
+    if (mIsPcaLoaded)
+    {
+        if (mPca.eigenvectors.rows != weights.cols || (int)mPca.mean.total() != mPca.eigenvectors.cols)
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - PCA transform does not match the SVM model", mClassName.c_str());
+            return;
+        }
+
+        cv::Mat eigen, mean;
+        mPca.eigenvectors.convertTo(eigen, CV_64F);
+        mPca.mean.reshape(1, 1).convertTo(mean, CV_64F);
+        weights = weights * eigen;
+        bias -= weights.dot(mean);
+    }
+
+    cv::Mat(weights.t()).convertTo(mSvmWeights, CV_32F);
+    mSvmBias = bias;
+    mIsSvmLinear = true;
 }
@@ -31,6 +31,26 @@
 #include "actuator.h"
 #include "descriptor_hog.h"
 #include "blob_2D.h"
+#include "framewriter.h"
+
+ /*************/
+// CvSVM giving access to its decision function, so that a linear model
+// can be collapsed into a single weight vector
+class Hog_Svm : public CvSVM
+{
+    public:
+        // Gets the weights and bias so that the decision value is weights.x + bias
+        // Returns false if the model is not a linear two classes (-1, 1) model
+        bool getLinearModel(cv::Mat& pWeights, double& pBias) const;
+};
+
+ /*************/
+// A detection window, at a given level of the pyramid
+struct Hog_Window
+{
+    cv::Point position; // Top left corner, in pixels of the level
+    int level;
+};
 
  /*************/
 // Class Actuator_Hog
@@ -68,8 +88,8 @@ class Actuator_Hog : public Actuator
         float mProcessNoiseCov, mMeasurementNoiseCov;
         float mMaximumVelocity; // Maximum speed of the detected blobs
 
-        // Descriptor to identify objects...
-        Descriptor_Hog mDescriptor;
+        // Descriptors to identify objects, one for each level of the pyramid...
+        std::vector<Descriptor_Hog> mDescriptors;
         // ... and its parameters
         cv::Size_<int> mRoiSize;
         cv::Size_<int> mBlockSize;
@@ -78,14 +98,22 @@ class Actuator_Hog : public Actuator
         cv::Size_<float> mCellStep;
         unsigned int mBins;
         float mSigma;
+        int mPyramidLevels; // Number of levels of the pyramid, 1 for a single scale detection
+        float mPyramidScale; // Scale factor between two levels
+        float mPyramidMinScale; // Scale of the first level, below 1 to upscale the input and detect objects smaller than the detection window
 
         // SVM...
-        CvSVM mSvm;
+        Hog_Svm mSvm;
         float mSvmMargin;
         bool mIsModelLoaded;
-        std::vector<cv::Point> mSvmValidPositions;
+        // ... collapsed with the PCA if the model is linear
+        bool mIsSvmLinear;
+        cv::Mat mSvmWeights; // Column vector, applied directly to the descriptors
+        float mSvmBias;
+        std::vector<Hog_Window> mSvmValidPositions;
         unsigned long long mMaxTimePerFrame; // Maximum time allowed per frame, in usec
         int mMaxThreads; // Maximum number of concurrent threads
+        int mScanStride; // Stride between evaluated windows, in cells
         // PCA ...
         cv::PCA mPca;
         bool mIsPcaLoaded;
@@ -96,11 +124,12 @@ class Actuator_Hog : public Actuator
 
         // Various variables
         cv::Mat mBgSubtractorBuffer;
-        cv::RNG mRng;
+        BinaryMask mForeground; // Eroded foreground, without shadows
         float mBlobMergeDistance; // Distance to considerer two blobs as one
         float mBlobTrackDistance; // Maximum distance to associate a blob with a new measure
         bool mSaveSamples; // If true, save samples older than mSaveSamplesAge
         unsigned long mSaveSamplesAge;
+        std::shared_ptr<FrameWriter> mSamplesWriter; // Samples are written asynchronously
         float mOcclusionDistance;
 
         std::vector<cv::Mat> mOutputBuffers;
@@ -108,7 +137,9 @@ class Actuator_Hog : public Actuator
         // Methods
         void make();
         void updateDescriptorParams();
-        void detectThroughMask(cv::Mat& mask, std::vector<cv::Point>& samples, bool timeLimited);
+        void updateLinearModel();
+        void detectThroughMask(std::vector<cv::Mat>& masks, std::vector<Hog_Window>& samples, bool timeLimited);
+        void evaluateWindows(const std::vector<Hog_Window>& points, std::vector<Hog_Window>& samples);
 };
 
 REGISTER_ACTUATOR(Actuator_Hog)
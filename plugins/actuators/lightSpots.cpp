@@ -32,17 +32,10 @@ void Actuator_LightSpots::make()
     mProcessNoiseCov = 1e-5;
     mMeasurementNoiseCov = 1e-5;
 
-    // Set mLightBlobDetector to indeed detect light
-    cv::SimpleBlobDetector::Params lParams;
-    lParams.filterByColor = true;
-    lParams.blobColor = 255;
-    lParams.minCircularity = 0.1f;
-    lParams.maxCircularity = 1.f;
-    lParams.minInertiaRatio = 0.f;
-    lParams.maxInertiaRatio = 1.f;
-    lParams.minArea = 0.f;
-    lParams.maxArea = 65535.f;
-    mLightBlobDetector = new cv::SimpleBlobDetector(lParams);
+    // Blob filtering, as previously done by the SimpleBlobDetector
+    mMinArea = 0.f;
+    mMaxArea = 65535.f;
+    mMinConvexity = 0.95f;
 }
 
 /*************/
@@ -54,8 +47,6 @@ atom::Message Actuator_LightSpots::detect(const vector< Capture_Ptr > pCaptures)
 
     cv::Mat lMean, lStdDev;
     cv::Mat lOutlier, lLight;
-    cv::Mat lEroded;
-    std::vector<cv::KeyPoint> lKeyPoints;
 
     // Eliminate the outliers : calculate the mean and std dev
     lOutlier = cv::Mat::zeros(captures[0].size[0], captures[0].size[1], CV_8U);
@@ -65,39 +56,37 @@ atom::Message Actuator_LightSpots::detect(const vector< Capture_Ptr > pCaptures)
     cv::meanStdDev(captures[0], lMean, lStdDev);
     cv::absdiff(lOutlier, lMean.at<double>(0), lOutlier);
 
-    // Detect pixels which values are superior to the mean
-    cv::threshold(lOutlier, lLight, lMean.at<double>(0), 255, cv::THRESH_BINARY);
-    
-    // Detect pixels far from the mean (> 2*stddev by default)
-    cv::threshold(lOutlier, lOutlier, mDetectionLevel * lStdDev.at<double>(0), 255, cv::THRESH_BINARY);
-    
-    // Combinaison of both previous conditions
-    cv::bitwise_and(lOutlier, lLight, lLight);
-
-    // Erode and dilate to suppress noise
-    cv::erode(lLight, lEroded, cv::Mat(), cv::Point(-1, -1), mFilterSize);
-    cv::dilate(lEroded, lLight, cv::Mat(), cv::Point(-1, -1), mFilterSize);
+    // Detect pixels which values are superior to the mean, and far from it (> 2*stddev by default)
+    // Both conditions result in a single threshold, fused with the erosion and dilation which suppress noise
+    double threshold = max(lMean.at<double>(0), mDetectionLevel * lStdDev.at<double>(0));
+    thresholdMorphology(lOutlier, threshold, mFilterSize, mFilterSize, lLight);
 
     // Apply the mask
-    cv::Mat lMask = getMask(lLight, CV_INTER_NN);
-    for (int x = 0; x < lLight.cols; ++x)
-        for (int y = 0; y < lLight.rows; ++y)
-        {
-            if (lMask.at<uchar>(y, x) == 0)
-                lLight.at<uchar>(y, x) = 0;
-        }
+    applyMask(lLight);
 
-    // Now we have to detect blobs
-    mLightBlobDetector->detect(lLight, lKeyPoints);
+    // Now we have to detect blobs. Contours are needed for the convexity
+    vector<Component> components = extractComponents(lLight, NULL, true);
     
-    // We use Blob::properties, not cv::KeyPoints
     std::vector<Blob::properties> lProperties;
-    for(int i = 0; i < std::min((int)(lKeyPoints.size()), mMaxTrackedBlobs); ++i)
+    for (auto& component : components)
     {
+        if ((int)lProperties.size() >= mMaxTrackedBlobs)
+            break;
+
+        if (component.area < mMinArea || component.area >= mMaxArea || component.contour.size() == 0)
+            continue;
+
+        vector<cv::Point> hull;
+        cv::convexHull(component.contour, hull);
+        double hullArea = cv::contourArea(hull);
+        if (hullArea == 0.0 || cv::contourArea(component.contour) / hullArea < mMinConvexity)
+            continue;
+
+        // Size is the diameter of the disc of the same area
         Blob::properties properties;
-        properties.position.x = lKeyPoints[i].pt.x;
-        properties.position.y = lKeyPoints[i].pt.y;
-        properties.size = lKeyPoints[i].size;
+        properties.position.x = component.centroid.x;
+        properties.position.y = component.centroid.y;
+        properties.size = 2.f * sqrtf((float)component.area / (float)CV_PI);
         properties.speed.x = 0.f;
         properties.speed.y = 0.f;
 
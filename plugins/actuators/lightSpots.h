@@ -45,13 +45,14 @@ class Actuator_LightSpots : public Actuator
         static std::string mDocumentation;
         static unsigned int mSourceNbr;
         
-        cv::SimpleBlobDetector* mLightBlobDetector; // OpenCV object which detects the blobs in an image
         std::vector<Blob2D> mLightBlobs; // Vector of detected and tracked blobs
 
         int mMaxTrackedBlobs;
         float mDetectionLevel;
         int mFilterSize;
         float mProcessNoiseCov, mMeasurementNoiseCov;
+        float mMinArea, mMaxArea;
+        float mMinConvexity; // Minimum ratio between the area of a blob and the area of its convex hull
 
         void make();
 };
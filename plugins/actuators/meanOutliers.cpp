@@ -41,49 +41,40 @@ atom::Message Actuator_MeanOutliers::detect(const vector< Capture_Ptr > pCapture
         return mLastMessage;
 
     cv::Mat lMean, lStdDev;
-    cv::Mat lOutlier, lEroded, lFiltered;
+    cv::Mat lOutlier, lFiltered;
 
     // Eliminate the outliers : calculate the mean and std dev
     lOutlier = cv::Mat::zeros(captures[0].size[0], captures[0].size[1], CV_8U);
-    lEroded = lOutlier.clone();
     lFiltered = lOutlier.clone();
     cv::cvtColor(captures[0], lOutlier, CV_RGB2GRAY);
 
     cv::meanStdDev(captures[0], lMean, lStdDev);
     cv::absdiff(lOutlier, lMean.at<double>(0), lOutlier);
 
-    // Detect pixels far from the mean (> 2*stddev)
-    cv::threshold(lOutlier, lOutlier, mDetectionLevel * lStdDev.at<double>(0), 255, cv::THRESH_BINARY);
-
-    // Erode and dilate to suppress noise
-    cv::erode(lOutlier, lEroded, cv::Mat(), cv::Point(-1, -1), mFilterSize);
-    cv::dilate(lEroded, lFiltered, cv::Mat(), cv::Point(-1, -1), mFilterSize);
+    // Detect pixels far from the mean (> 2*stddev), then erode and dilate to suppress noise
+    thresholdMorphology(lOutlier, mDetectionLevel * lStdDev.at<double>(0), mFilterSize, mFilterSize, lFiltered);
 
     // Apply the mask
-    cv::Mat lMask = getMask(lFiltered, cv::INTER_NEAREST);
-    cv::parallel_for_(cv::Range(0, lFiltered.rows), Parallel_Mask<uchar>(&lFiltered, &lMask));
+    applyMask(lFiltered);
 
     // Calculate the barycenter of the outliers
+    vector<Component> components = extractComponents(lFiltered);
     int lNumber = 0;
     int lX = 0, lY = 0;
-
-    for (int x = 0; x < lFiltered.size[1]; ++x)
-        for (int y = 0; y < lFiltered.size[0]; ++y)
-        {
-            if (lFiltered.at<uchar>(y, x) == 255)
-            {
-                lX += x;
-                lY += y;
-                lNumber++;
-            }
-        }
+    float sumX = 0.f, sumY = 0.f;
+    for (auto& component : components)
+    {
+        sumX += component.centroid.x * component.area;
+        sumY += component.centroid.y * component.area;
+        lNumber += component.area;
+    }
 
     bool isDetected = false;
     if(lNumber > 0)
     {
         isDetected = true;
-        lX /= lNumber;
-        lY /= lNumber;
+        lX = (int)(sumX / lNumber);
+        lY = (int)(sumY / lNumber);
     }
     else
     {
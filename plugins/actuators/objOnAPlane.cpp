@@ -142,34 +142,30 @@ atom::Message Actuator_ObjOnAPlane::detect(const vector< Capture_Ptr > pCaptures
     cv::remap(detected, realDetected, mMaps[0], cv::Mat(), cv::INTER_LINEAR);
 
     // Erode and dilate to suppress noise
-    cv::Mat lEroded;
-    cv::erode(realDetected, lEroded, cv::Mat(), cv::Point(-1, -1), mFilterSize);
-    cv::dilate(lEroded, realDetected, cv::Mat(), cv::Point(-1, -1), mFilterSize*2);
+    thresholdMorphology(realDetected, 0, mFilterSize, mFilterSize*2, realDetected);
 
     // Apply the mask
-    cv::Mat lMask = getMask(realDetected, cv::INTER_NEAREST);
-    cv::parallel_for_(cv::Range(0, realDetected.rows), Parallel_Mask<uchar>(&realDetected, &lMask));
+    applyMask(realDetected);
 
-    // Detect blobs
-    std::vector<std::vector<cv::Point>> contours;
-    std::vector<cv::Vec4i> hierarchy;
-    cv::findContours(realDetected, contours, hierarchy, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_TC89_L1);
+    // Detect blobs. Contours are only used for display
+    vector<Component> components = extractComponents(realDetected, NULL, true);
 
     std::vector<Blob::properties> lProperties;
-    for(int i = 0; i < std::min((int)(contours.size()), mMaxTrackedBlobs); ++i)
+    for(int i = 0; i < std::min((int)(components.size()), mMaxTrackedBlobs); ++i)
     {
-        cv::Rect rect = cv::boundingRect(contours[i]);
+        cv::Rect rect = components[i].box;
 
         Blob::properties properties;
         properties.position.x = rect.x + rect.width / 2;
         properties.position.y = rect.y + rect.height / 2;
-        properties.size = cv::contourArea(contours[i], false);
+        properties.size = components[i].area;
         properties.speed.x = 0.f;
         properties.speed.y = 0.f;
 
         if (properties.size > mMinArea)
         {
-            cv::drawContours(realDetected, contours, i, cv::Scalar(255, 0, 0), 2);
+            std::vector<std::vector<cv::Point>> contours(1, components[i].contour);
+            cv::drawContours(realDetected, contours, 0, cv::Scalar(255, 0, 0), 2);
             lProperties.push_back(properties);
         }
     }
@@ -15,8 +15,7 @@ Actuator::Actuator()
     mVerbose = true;
 
     mOutputBuffer = cv::Mat::zeros(480, 640, CV_8U);
-    // By default, the mask is all white (all pixels are used)
-    mSourceMask = cv::Mat::ones(1, 1, CV_8U);
+    // By default, no mask is set (all pixels are used)
 }
 
 /**************/
@@ -28,8 +27,7 @@ Actuator::Actuator(int pParam)
 /**************/
 void Actuator::setMask(cv::Mat pMask)
 {
-    mSourceMask = pMask.clone();
-    mMask = pMask.clone();
+    mMask.set(pMask);
 }
 
 /**************/
@@ -87,12 +85,9 @@ void Actuator::addSource(shared_ptr<Source> source)
 }
 
 /**************/
-cv::Mat Actuator::getMask(cv::Mat pCapture, int pInterpolation)
+void Actuator::applyMask(cv::Mat& pImg)
 {
-    if (pCapture.rows != mMask.rows || pCapture.cols != mMask.cols)
-        cv::resize(mSourceMask, mMask, pCapture.size(), 0, 0, pInterpolation);
-
-    return mMask;
+    mMask.apply(pImg);
 }
 
 /**************/
@@ -8,9 +8,32 @@ using namespace std;
 
 /*************/
 // LookupTable
+/*************/
+// Evaluates a table given by its keys
+// Values out of [start[0], end[0]] are returned as is
+static inline float evaluateTable(float value, const vector<float>& in, const vector<float>& out,
+                                  const float* start, const float* end)
+{
+    if (value < start[0] || value > end[0])
+        return value;
+
+    if (value == start[0])
+        return start[1];
+    if (value == end[0])
+        return end[1];
+
+    int upper = upper_bound(in.begin(), in.end(), value) - in.begin();
+    int lower = upper - 1;
+
+    float ratio = (value - in[lower]) / (in[upper] - in[lower]);
+    return out[lower] + ratio * (out[upper] - out[lower]);
+}
+
+/*************/
 LookupTable::LookupTable()
 {
     mIsSet = false;
+    mInterpolation = linear;
 
     mStart[0] = numeric_limits<float>::max();
     mEnd[0] = numeric_limits<float>::min();
@@ -21,23 +44,46 @@ LookupTable::LookupTable()
 /*************/
 LookupTable::LookupTable(interpolation inter, vector< vector<float> > keys)
 {
+    mIsSet = false;
+    mOutOfRange = true;
     set(inter, keys);
 }
 
 /*************/
-void LookupTable::set(interpolation inter, vector< vector<float> > keys)
+void LookupTable::set(interpolation inter, const vector< vector<float> >& keys)
 {
+    if (keys.size() == 0)
+        return;
+
     mInterpolation = inter; 
-    mKeys = keys;
-    sort(mKeys.begin(), mKeys.end(), [] (vector<float> a, vector<float> b)
+
+    // Keys are sorted through an index, to prevent copying them around
+    vector<int> order(keys.size());
+    for (int i = 0; i < order.size(); ++i)
+        order[i] = i;
+
+    sort(order.begin(), order.end(), [&] (int a, int b) {return keys[a][0] < keys[b][0];});
+    mKeysIn.resize(keys.size());
+    mKeysOut.resize(keys.size());
+    for (int i = 0; i < order.size(); ++i)
+    {
+        mKeysIn[i] = keys[order[i]][0];
+        mKeysOut[i] = keys[order[i]][1];
+    }
+
+    sort(order.begin(), order.end(), [&] (int a, int b) {return keys[a][1] < keys[b][1];});
+    mInverseIn.resize(keys.size());
+    mInverseOut.resize(keys.size());
+    for (int i = 0; i < order.size(); ++i)
     {
-        return a[0] < b[0];
-    });
+        mInverseIn[i] = keys[order[i]][1];
+        mInverseOut[i] = keys[order[i]][0];
+    }
 
-    mStart[0] = (*(mKeys.begin()))[0];
-    mStart[1] = (*(mKeys.begin()))[1];
-    mEnd[0] = (*(mKeys.end() - 1))[0];
-    mEnd[1] = (*(mKeys.end() - 1))[1];
+    mStart[0] = mKeysIn.front();
+    mStart[1] = mKeysOut.front();
+    mEnd[0] = mKeysIn.back();
+    mEnd[1] = mKeysOut.back();
 
     mOutOfRange = true;
     mIsSet = true;
@@ -46,67 +92,30 @@ void LookupTable::set(interpolation inter, vector< vector<float> > keys)
 /*************/
 float LookupTable::operator[](const float& value)
 {
-    mOutOfRange = true;
-    if (mInterpolation == interpolation::linear)
+    if (!mIsSet)
     {
-        if (value < mStart[0])
-            return value;
-        if (value > mEnd[0])
-            return value;
-
-        mOutOfRange = false;
-
-        if (value == mStart[0])
-            return mStart[1];
-        if (value == mEnd[0])
-            return mEnd[1];
-
-        vector<float> a;
-        a.push_back(value);
-        auto upper = upper_bound(mKeys.begin(), mKeys.end(), a, [] (vector<float> a, vector<float> b)
-        {
-            return a[0] < b[0];
-        });
-        auto lower = upper - 1;
-
-        float ratio = (a[0] - (*lower)[0]) / ((*upper)[0] - (*lower)[0]);
-        float result = (*lower)[1] + ratio * ((*upper)[1] - (*lower)[1]);
-        return result;
+        mOutOfRange = true;
+        return value;
     }
+
+    mOutOfRange = (value < mStart[0] || value > mEnd[0]);
+    return evaluateTable(value, mKeysIn, mKeysOut, mStart, mEnd);
 }
 
 /*************/
 float LookupTable::inverse(const float& value)
 {
-    mOutOfRange = true;
-    if (mInterpolation == interpolation::linear)
+    if (!mIsSet)
     {
-        if (value < mStart[1])
-            return value;
-        if (value > mEnd[1])
-            return value;
-
-        mOutOfRange = false;
-
-        if (value == mStart[1])
-            return mStart[0];
-        if (value == mEnd[1])
-            return mEnd[0];
-
-        vector<float> a;
-        a.push_back(0.f);
-        a.push_back(value);
-        auto upper = upper_bound(mKeys.begin(), mKeys.end(), a, [] (vector<float> a, vector<float> b)
-        {
-            return a[1] < b[1];
-        });
-        auto lower = upper - 1;
-
-        float ratio = (a[1] - (*lower)[1]) / ((*upper)[1] - (*lower)[1]);
-        float result = (*lower)[0] + ratio * ((*upper)[0] - (*lower)[0]);
-        return result;
+        mOutOfRange = true;
+        return value;
     }
 
+    float start[2] = {mInverseIn.front(), mInverseOut.front()};
+    float end[2] = {mInverseIn.back(), mInverseOut.back()};
+
+    mOutOfRange = (value < start[0] || value > end[0]);
+    return evaluateTable(value, mInverseIn, mInverseOut, start, end);
 }
 
 /*************/
@@ -119,11 +128,22 @@ ShmAuto::ShmAuto(const char* filename)
 /*************/
 void ShmAuto::setCapture(Capture_Ptr& capture, const unsigned long long timestamp)
 {
-    if (dynamic_pointer_cast<Capture_2D_Mat>(capture).get() != NULL)
+    Capture_2D_Mat_Ptr capture2D = dynamic_pointer_cast<Capture_2D_Mat>(capture);
+    if (capture2D.get() != NULL)
     {
         if (dynamic_pointer_cast<ShmImage>(mShm).get() == NULL)
             mShm.reset(new ShmImage(mFilename.c_str()));
-        mShm->setCapture(capture);
+
+        cv::Mat tonemapped;
+        if (mTonemapper.get() != NULL && mTonemapper->process(capture2D->get(), tonemapped))
+        {
+            Capture_Ptr tonemappedCapture(new Capture_2D_Mat(tonemapped));
+            mShm->setCapture(tonemappedCapture, timestamp);
+        }
+        else
+        {
+            mShm->setCapture(capture, timestamp);
+        }
     }
 #if HAVE_PCL
     else if (dynamic_pointer_cast<Capture_3D_PclRgba>(capture).get() != NULL)
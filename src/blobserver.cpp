@@ -38,6 +38,7 @@
 #endif
 #include "source_2d_image.h"
 #include "source_2d_opencv.h"
+#include "source_2d_recording.h"
 #include "source_2d_shmdata.h"
 #include "source_3d_shmdata.h"
 
@@ -56,6 +57,7 @@ static gchar* gPort = NULL;
 
 static gboolean gBench = FALSE;
 static gboolean gDebug = FALSE;
+static gboolean gTonemapShm = FALSE;
 
 static GOptionEntry gEntries[] =
 {
@@ -68,6 +70,7 @@ static GOptionEntry gEntries[] =
     {"port", 'p', 0, G_OPTION_ARG_STRING, &gPort, "Specifies TCP port to use for server (default 9002)", NULL},
     {"bench", 'B', 0, G_OPTION_ARG_NONE, &gBench, "Enables printing timings of main loop, for debug purpose", NULL},
     {"debug", 'd', 0, G_OPTION_ARG_NONE, &gDebug, "Enables printing of debug messages", NULL},
+    {"tonemap", 'T', 0, G_OPTION_ARG_NONE, &gTonemapShm, "Tonemaps HDR (float) outputs to 8 bits before sending them through shmdata", NULL},
     {NULL}
 };
 
@@ -317,6 +320,8 @@ void App::registerClasses()
         Source_2D_OpenCV::getDocumentation());
     mSourceFactory.register_class<Source_2D_Image>(Source_2D_Image::getClassName(),
         Source_2D_Image::getDocumentation());
+    mSourceFactory.register_class<Source_2D_Recording>(Source_2D_Recording::getClassName(),
+        Source_2D_Recording::getDocumentation());
 #if HAVE_ARAVIS
     mSourceFactory.register_class<Source_2D_Gige>(Source_2D_Gige::getClassName(),
         Source_2D_Gige::getDocumentation());
@@ -399,6 +404,7 @@ int App::loop()
 
     bool lShowCamera = !gHide;
     int lSourceNumber = 0;
+    Tonemapper lDisplayTonemapper;
 
     unsigned long long usecPeriod = 1e6 / (long long)gFramerate;
 
@@ -494,8 +500,10 @@ int App::loop()
                     {
                         char shmFile[128];
                         sprintf(shmFile, "/tmp/blobserver_%i_%s_%i", flow.id, flow.actuator->getOscPath().c_str(), i);
-                        shared_ptr<Shm> shm;
+                        shared_ptr<ShmAuto> shm;
                         shm.reset(new ShmAuto(shmFile));
+                        if (gTonemapShm)
+                            shm->setTonemapper(make_shared<Tonemapper>());
                         flow.sink.push_back(shm);
                     }
                         
@@ -590,19 +598,12 @@ int App::loop()
                 cv::Mat displayMat = img->get().clone();
                 if (displayMat.depth() == CV_32F)
                 {
-                    float maxValue = 0.f;
-                    for (int x = 0; x < displayMat.cols; ++x)
-                        for (int y = 0; y < displayMat.rows; ++y)
-                            for (int c = 0; c < displayMat.channels(); ++c)
-                                maxValue = max(maxValue, displayMat.at<cv::Vec3f>(y, x)[c]);
-                    g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - Maximum value for the HDR tonemapping: %f", __FUNCTION__, maxValue);
-            
-                    cv::Mat buffer = cv::Mat::zeros(displayMat.size(), CV_8UC3);
-                    displayMat /= maxValue;
-                    cv::pow(displayMat, 1.0 / 2.2, displayMat);
-                    displayMat *= 255.f;
-                    displayMat.convertTo(buffer, CV_8UC3);
-                    displayMat = buffer;
+                    cv::Mat buffer;
+                    if (lDisplayTonemapper.process(displayMat, buffer))
+                    {
+                        g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - Maximum value for the HDR tonemapping: %f", __FUNCTION__, lDisplayTonemapper.getReference());
+                        displayMat = buffer;
+                    }
                 }
                 cv::putText(displayMat, lBufferNames[lSourceNumber].c_str(), cv::Point(10, 30),
                     cv::FONT_HERSHEY_COMPLEX, 1.0, cv::Scalar::all(0.0), 3.0);
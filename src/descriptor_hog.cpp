@@ -1,68 +1,187 @@
 #include "descriptor_hog.h"
 
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 
+// Gradients of 8 bits images lie in [-255, 255] along each direction
+#define GRADIENT_RANGE 255
+#define GRADIENT_TABLE_WIDTH (2 * GRADIENT_RANGE + 1)
+
+/*************/
+// Builds the table giving the stored orientation and length for each possible gradient.
+// The values are computed exactly as they used to be per pixel, wrapping to 8 bits included
+static vector<cv::Vec2b> buildGradientTable(const bool isSigned)
+{
+    vector<cv::Vec2b> table(GRADIENT_TABLE_WIDTH * GRADIENT_TABLE_WIDTH);
+    for (int v = -GRADIENT_RANGE; v <= GRADIENT_RANGE; ++v)
+        for (int h = -GRADIENT_RANGE; h <= GRADIENT_RANGE; ++h)
+        {
+            float hValue = h;
+            float vValue = v;
+            float length = sqrtf(hValue*hValue + vValue*vValue);
+
+            float angle = 0.f;
+            if (length > 0.f)
+            {
+                hValue /= length;
+                angle = acos(hValue);
+            }
+
+            if (isSigned && vValue < 0.f)
+            {
+                angle = 2.0*CV_PI - angle;
+                angle = (int)(angle / CV_PI * 180) % 360;
+            }
+            else
+            {
+                angle = (int)(angle / CV_PI * 180) % 180;
+            }
+
+            cv::Vec2b& entry = table[(v + GRADIENT_RANGE) * GRADIENT_TABLE_WIDTH + h + GRADIENT_RANGE];
+            entry[0] = (uchar)(int)angle;
+            entry[1] = (uchar)(int)length;
+        }
+
+    return table;
+}
+
+/*************/
+static const cv::Vec2b* getGradientTable(const bool isSigned)
+{
+    if (isSigned)
+    {
+        static const vector<cv::Vec2b> signedTable = buildGradientTable(true);
+        return signedTable.data();
+    }
+    else
+    {
+        static const vector<cv::Vec2b> unsignedTable = buildGradientTable(false);
+        return unsignedTable.data();
+    }
+}
+
 /*************/
 // Class for parallel computation of gradients
+// Central differences are computed directly from the 8 bits image, for all channels at once,
+// and the orientation and length of the strongest channel are read from a table
 class Parallel_Gradients : public cv::ParallelLoopBody
 {
     public:
-        Parallel_Gradients(cv::Mat* gradientsH, cv::Mat* gradientsV, cv::Mat* gradients, const int channels, const bool isSigned):
-            _gradientsH(gradientsH), _gradientsV(gradientsV), _gradients(gradients), _cn(channels), _signed(isSigned) {}
+        Parallel_Gradients(const cv::Mat* source, const cv::Point offset, cv::Mat* gradients, const int channels, const bool isSigned):
+            _source(source), _offset(offset), _gradients(gradients), _cn(channels), _table(getGradientTable(isSigned)) {}
 
         void operator()(const cv::Range& r) const
         {
-            for (int y = r.start; y != r.end; ++y)
+            const int length = _gradients->cols * _cn;
+            // Missing neighbours are reflected, which gives a null difference on the image borders
+            const int first = _offset.x > 0 ? 0 : _cn;
+            const int last = _offset.x + _gradients->cols < _source->cols ? length : length - _cn;
+
+            vector<short> diffH(length, 0), diffV(length, 0);
+            vector<int> magnitudes(length, 0);
+
+            for (int y = r.start; y < r.end; ++y)
             {
-                for (int x = 0; x < _gradients->cols; ++x)
+                const int sourceY = y + _offset.y;
+                const int upY = sourceY > 0 ? sourceY - 1 : min(sourceY + 1, _source->rows - 1);
+                const int downY = sourceY + 1 < _source->rows ? sourceY + 1 : max(sourceY - 1, 0);
+
+                const uchar* current = _source->ptr<uchar>(sourceY) + _offset.x * _cn;
+                const uchar* up = _source->ptr<uchar>(upY) + _offset.x * _cn;
+                const uchar* down = _source->ptr<uchar>(downY) + _offset.x * _cn;
+
+                for (int x = 0; x < first; ++x)
+                {
+                    diffH[x] = 0;
+                    diffV[x] = (short)down[x] - (short)up[x];
+                    magnitudes[x] = diffV[x] * diffV[x];
+                }
+
+                int x = first;
+#if CV_SSE2
+                const __m128i zero = _mm_setzero_si128();
+                for (; x + 8 <= last; x += 8)
                 {
-                    float hValue = 0.f;
-                    float vValue = 0.f;
-                    float length = 0.f;
-
-                    for (int i = 0; i < _cn; ++i)
-                    {
-                        float cnHValue = _gradientsH[i].at<short>(y, x);
-                        float cnVValue = _gradientsV[i].at<short>(y, x);
-                        float cnLength = sqrtf(cnHValue*cnHValue + cnVValue*cnVValue);
-
-                        if (cnLength > length)
-                        {
-                            hValue = cnHValue;
-                            vValue = cnVValue;
-                            length = cnLength;
-                        }
-                    }
-
-                    float angle = 0.f;
-                    if (length > 0.f)
-                    {
-                        hValue /= length;
-                        angle = acos(hValue);
-                    }
-
-                    if (_signed && vValue < 0.f)
-                    {
-                        angle = 2.0*CV_PI - angle;
-                        angle = (int)(angle / CV_PI * 180) % 360;
-                    }
-                    else
-                    {
-                        angle = (int)(angle / CV_PI * 180) % 180;
-                    }
-
-                    _gradients->at<cv::Vec2b>(y, x)[0] = (char)angle;
-                    _gradients->at<cv::Vec2b>(y, x)[1] = (char)length;
+                    __m128i left = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(current + x - _cn)), zero);
+                    __m128i right = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(current + x + _cn)), zero);
+                    __m128i top = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(up + x)), zero);
+                    __m128i bottom = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i*)(down + x)), zero);
+
+                    __m128i h = _mm_sub_epi16(right, left);
+                    __m128i v = _mm_sub_epi16(bottom, top);
+                    _mm_storeu_si128((__m128i*)(&diffH[x]), h);
+                    _mm_storeu_si128((__m128i*)(&diffV[x]), v);
+
+                    // Squared lengths, from the interleaved differences
+                    __m128i low = _mm_unpacklo_epi16(h, v);
+                    __m128i high = _mm_unpackhi_epi16(h, v);
+                    _mm_storeu_si128((__m128i*)(&magnitudes[x]), _mm_madd_epi16(low, low));
+                    _mm_storeu_si128((__m128i*)(&magnitudes[x + 4]), _mm_madd_epi16(high, high));
+                }
+#endif
+                for (; x < last; ++x)
+                {
+                    diffH[x] = (short)current[x + _cn] - (short)current[x - _cn];
+                    diffV[x] = (short)down[x] - (short)up[x];
+                    magnitudes[x] = diffH[x] * diffH[x] + diffV[x] * diffV[x];
+                }
+
+                for (; x < length; ++x)
+                {
+                    diffH[x] = 0;
+                    diffV[x] = (short)down[x] - (short)up[x];
+                    magnitudes[x] = diffV[x] * diffV[x];
+                }
+
+                // The channel with the strongest gradient is kept, the first one in case of equality
+                cv::Vec2b* gradients = _gradients->ptr<cv::Vec2b>(y);
+                for (int pixel = 0, index = 0; pixel < _gradients->cols; ++pixel, index += _cn)
+                {
+                    int best = index;
+                    for (int i = 1; i < _cn; ++i)
+                        if (magnitudes[index + i] > magnitudes[best])
+                            best = index + i;
+
+                    gradients[pixel] = _table[(diffV[best] + GRADIENT_RANGE) * GRADIENT_TABLE_WIDTH + diffH[best] + GRADIENT_RANGE];
                 }
             }
         }
 
     private:
-        cv::Mat* _gradientsH;
-        cv::Mat* _gradientsV;
+        const cv::Mat* _source;
+        const cv::Point _offset;
         cv::Mat* _gradients;
         const int _cn;
-        const bool _signed;
+        const cv::Vec2b* _table;
+};
+
+/*************/
+// Class for parallel computation of the cell histograms grid, one row of cells at a time
+class Parallel_CellHistograms : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_CellHistograms(const Descriptor_Hog* descriptor, const cv::Size_<int> cellSize, const int cols, float* histograms):
+            _descriptor(descriptor), _cellSize(cellSize), _cols(cols), _histograms(histograms) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const int bins = _descriptor->_binsPerCell;
+            for (int y = r.start; y < r.end; ++y)
+                for (int x = 0; x < _cols; ++x)
+                {
+                    cv::Point_<int> topLeft(x * _cellSize.width, y * _cellSize.height);
+                    _descriptor->getCellHistogram(topLeft, _cellSize, _histograms + (y * _cols + x) * bins);
+                }
+        }
+
+    private:
+        const Descriptor_Hog* _descriptor;
+        const cv::Size_<int> _cellSize;
+        const int _cols;
+        float* _histograms;
 };
 
 /*************/
@@ -80,44 +199,55 @@ Descriptor_Hog::Descriptor_Hog():
     _gaussSigma = 0.0f;
 
     _epsilon = FLT_EPSILON;
-    _kernelH = cv::Mat(1, 3, CV_32FC1);
-    _kernelH.at<float>(0, 0) = -1.f;
-    _kernelH.at<float>(0, 1) = 0.f;
-    _kernelH.at<float>(0, 2) = 1.f;
-    _kernelV = _kernelH.t();
 
     _cellMinSize = cv::Size_<int>(0, 0);
     _cellMaxSize = cv::Size_<int>(0, 0);
     _cellStep = cv::Size_<float>(1.f, 1.f);
+
+    updateBinning();
+    updateBlockWeights();
 }
 
 /*************/
 void Descriptor_Hog::setImage(const cv::Mat& pImage)
 {
-    cv::Mat tmpImage = pImage.clone();
+    if (pImage.depth() == CV_8U)
+        _image = pImage;
+    else
+        pImage.convertTo(_image, CV_8U);
 
     if (_doCrop)
-        _image = cv::Mat(tmpImage, _cropRect);
-    else
-        _image = tmpImage;
+        _image = cv::Mat(_image, _cropRect);
 
-    cv::Mat gradientsH; //(_image.rows, _image.cols, pImage.type());
-    cv::Mat gradientsV; //(_image.rows, _image.cols, pImage.type());
     int cn = CV_MAT_CN(_image.type());
 
-    cv::filter2D(_image, gradientsH, CV_16S, _kernelH);
-    cv::filter2D(_image, gradientsV, CV_16S, _kernelV);
-
-    // Compute the oriented gradient for each pixel
-    cv::Mat channelsH[cn];
-    cv::Mat channelsV[cn];
-    cv::split(gradientsH, channelsH);
-    cv::split(gradientsV, channelsV);
+    // Gradients on the borders of a crop use the pixels around it, when available
+    cv::Size wholeSize;
+    cv::Point offset;
+    _image.locateROI(wholeSize, offset);
+    cv::Mat source = _image;
+    int top = min(1, offset.y);
+    int left = min(1, offset.x);
+    source.adjustROI(top, min(1, wholeSize.height - offset.y - _image.rows), left, min(1, wholeSize.width - offset.x - _image.cols));
 
     if (_gradients.cols != _image.cols || _gradients.rows != _image.rows)
         _gradients = cv::Mat(_image.rows, _image.cols, CV_8UC2);
 
-    cv::parallel_for_(cv::Range(0, _gradients.rows), Parallel_Gradients(channelsH, channelsV, &_gradients, cn, _signed));
+    // Compute the oriented gradient for each pixel
+    cv::parallel_for_(cv::Range(0, _gradients.rows), Parallel_Gradients(&source, cv::Point(left, top), &_gradients, cn, _signed));
+
+    // Cell histograms are computed once for all the descriptors of this image
+    vector< cv::Size_<int> > cellSizes = getCellSizes();
+    _cellGrids.resize(cellSizes.size());
+    for (unsigned int i = 0; i < cellSizes.size(); ++i)
+    {
+        CellGrid& grid = _cellGrids[i];
+        grid.cellSize = cellSizes[i];
+        grid.cols = grid.cellSize.width > 0 ? _gradients.cols / grid.cellSize.width : 0;
+        grid.rows = grid.cellSize.height > 0 ? _gradients.rows / grid.cellSize.height : 0;
+        grid.histograms.resize(grid.cols * grid.rows * _binsPerCell);
+        cv::parallel_for_(cv::Range(0, grid.rows), Parallel_CellHistograms(this, grid.cellSize, grid.cols, grid.histograms.data()));
+    }
 }
 
 /*************/
@@ -125,11 +255,28 @@ vector<float> Descriptor_Hog::getDescriptor(cv::Point_<int> pPos) const
 {
     vector<float> descriptor;
 
+    vector< cv::Size_<int> > cellSizes = getCellSizes();
+    for (auto& cellSize : cellSizes)
+    {
+        vector<float> addedVectors = getSingleScaleDescriptor(pPos, cellSize);
+        if (cellSizes.size() == 1)
+            return addedVectors;
+        descriptor.insert(descriptor.end(), addedVectors.begin(), addedVectors.end());
+    }
+
+    return descriptor;
+}
+
+/*************/
+vector< cv::Size_<int> > Descriptor_Hog::getCellSizes() const
+{
+    vector< cv::Size_<int> > cellSizes;
+
     if (_cellMinSize == cv::Size_<int>(0, 0) ||
         _cellMaxSize == cv::Size_<int>(0, 0) ||
         _cellStep == cv::Size_<float>(0.f, 0.f))
     {
-        descriptor = getSingleScaleDescriptor(pPos, _cellSize);
+        cellSizes.push_back(_cellSize);
     }
     else
     {
@@ -141,11 +288,7 @@ vector<float> Descriptor_Hog::getDescriptor(cv::Point_<int> pPos) const
 
             while (cellSize.height <= _cellMaxSize.height)
             {
-                int currentSize = descriptor.size();
-                vector<float> addedVectors = getSingleScaleDescriptor(pPos, cellSize);
-                descriptor.resize(currentSize + addedVectors.size());
-                copy(addedVectors.begin(), addedVectors.end(), descriptor.begin() + currentSize);
-
+                cellSizes.push_back(cellSize);
                 cellSize.height = (int)((float)cellSize.height * _cellStep.height);
             }
 
@@ -153,7 +296,7 @@ vector<float> Descriptor_Hog::getDescriptor(cv::Point_<int> pPos) const
         }
     }
 
-    return descriptor;
+    return cellSizes;
 }
 
 /*************/
@@ -161,12 +304,6 @@ vector<float> Descriptor_Hog::getSingleScaleDescriptor(cv::Point_<int> pPos, con
 {
     vector<float> descriptor;
 
-    // Angle covered per bin
-    float anglePerBin = 180.f / (float)_binsPerCell;
-    if (_signed)
-        anglePerBin *= 2.f;
-    float binPerAngle = 1.f / anglePerBin;
-
     // Check if we have enough room to build a complete descriptor
     if (pPos.x + _roiSize.width > _image.cols || pPos.y + _roiSize.height > _image.rows)
         return descriptor;
@@ -177,86 +314,147 @@ vector<float> Descriptor_Hog::getSingleScaleDescriptor(cv::Point_<int> pPos, con
 
     int cellNumberH = _roiSize.width / pCellSize.width;
     int cellNumberV = _roiSize.height / pCellSize.height;
-    
-    // For each cell, we compute its descriptor
-    vector< vector<float> > cellsDescriptor;
-    for (int cellH = 0; cellH < cellNumberH; ++cellH)
-        for (int cellV = 0; cellV < cellNumberV; ++cellV)
-        {
-            cv::Point_<int> topLeft;
-            topLeft.x = cellH * pCellSize.width + pPos.x;
-            topLeft.y = cellV * pCellSize.height + pPos.y;
-            
-            // Creation of the histogram
-            vector<float> cellDescriptor;
-            cellDescriptor.assign(_binsPerCell, 0);
-            for (int x = 0; x < pCellSize.width; ++x)
-                for (int y = 0; y < pCellSize.height; ++y)
-                {
-                    cv::Point position(topLeft.x + x, topLeft.y + y);
-                    int index = _gradients.at<cv::Vec2b>(position.y, position.x)[0] * binPerAngle;
-                    float subPos = _gradients.at<cv::Vec2b>(position.y, position.x)[0] - index*anglePerBin;
-                    int shift = (subPos < anglePerBin*0.5f) ? -1 : 1;
-                    if (shift + index < 0)
-                        shift = _binsPerCell-1;
-                    else if (shift + index >= _binsPerCell)
-                        shift = 0;
-                    else
-                        shift += index;
-
-                    float ratio = abs(subPos - anglePerBin*0.5f) * binPerAngle;
-                    cellDescriptor[index] += _gradients.at<cv::Vec2b>(position.y, position.x)[1] * (1.f - ratio);
-                    cellDescriptor[shift] += _gradients.at<cv::Vec2b>(position.y, position.x)[1] * ratio;
-                }
 
-            // We normalize the cell
-            float invNorm = 1.f / getDescriptorNorm(cellDescriptor);
-            for (int i = 0; i < _binsPerCell; ++i)
-                cellDescriptor[i] *= invNorm;
+    // Cells descriptors are taken from the grid if the position is aligned with it,
+    // otherwise they are computed here. They are ordered column by column
+    vector<const float*> cellsDescriptor(cellNumberH * cellNumberV, NULL);
+    vector<float> localCells;
 
-            cellsDescriptor.push_back(cellDescriptor);
-        }
+    const CellGrid* grid = NULL;
+    for (auto& cellGrid : _cellGrids)
+        if (cellGrid.cellSize == pCellSize && pPos.x % pCellSize.width == 0 && pPos.y % pCellSize.height == 0)
+            grid = &cellGrid;
+
+    if (grid != NULL)
+    {
+        int gridX = pPos.x / pCellSize.width;
+        int gridY = pPos.y / pCellSize.height;
+        for (int cellH = 0; cellH < cellNumberH; ++cellH)
+            for (int cellV = 0; cellV < cellNumberV; ++cellV)
+                cellsDescriptor[cellH * cellNumberV + cellV] = &grid->histograms[((gridY + cellV) * grid->cols + gridX + cellH) * _binsPerCell];
+    }
+    else
+    {
+        localCells.resize(cellNumberH * cellNumberV * _binsPerCell);
+        for (int cellH = 0; cellH < cellNumberH; ++cellH)
+            for (int cellV = 0; cellV < cellNumberV; ++cellV)
+            {
+                int index = cellH * cellNumberV + cellV;
+                cv::Point_<int> topLeft(cellH * pCellSize.width + pPos.x, cellV * pCellSize.height + pPos.y);
+                getCellHistogram(topLeft, pCellSize, &localCells[index * _binsPerCell]);
+                cellsDescriptor[index] = &localCells[index * _binsPerCell];
+            }
+    }
 
     // We have all cells descriptors. Now we normalize them to create the global descriptor
+    const int blockBins = _binsPerCell * (_blockSize.width*_blockSize.height);
+    const int blockNumber = max(0, cellNumberH - (_blockSize.width - 1)) * max(0, cellNumberV - (_blockSize.height - 1));
+    descriptor.resize(blockNumber * blockBins);
+
+    int descriptorIndex = 0;
     for (int cellH = 0; cellH < cellNumberH - (_blockSize.width - 1); ++cellH)
         for (int cellV = 0; cellV < cellNumberV - (_blockSize.height - 1); ++cellV)
         {
-            int blockCenterH = cellH + (_blockSize.width << 2);
-            int blockCenterV = cellV + (_blockSize.height << 2);
-
-            vector<float> descriptorVector;
-            descriptorVector.assign(_binsPerCell * (_blockSize.width*_blockSize.height), 0);
+            float* descriptorVector = &descriptor[descriptorIndex];
             // We calculate the norm of the descriptor over the whole block
             // So we go over all the cells for the current block
             for (int i = 0; i < _blockSize.width; ++i)
                 for (int j = 0; j < _blockSize.height; ++j)
                 {
-                    //int index = blockCenterH+i + (blockCenterH+j)*windowV;
+                    // The cells are indexed row by row here, while they are stored column by column.
+                    // This has always been so, and the trained models depend on it
                     int index = cellH+i + (cellV+j) * cellNumberH;
 
                     // We apply a gaussian curve over the blocks
-                    float gaussianFactor = 1.f;
-                    if (_gaussSigma != 0.f)
-                    {
-                        float distToCenterBlock = sqrtf(pow((float)i - (float)_blockSize.width*0.5f + 0.5, 2.f) + pow((float)j - (float)_blockSize.height*0.5f + 0.5, 2.f));
-                        gaussianFactor = getGaussian(distToCenterBlock, _gaussSigma);
-                    }
-
+                    float gaussianFactor = _blockWeights[i + j*_blockSize.width];
+                    const float* cellDescriptor = cellsDescriptor[index];
                     for (int orientation = 0; orientation < _binsPerCell; ++orientation)
-                        descriptorVector[orientation + (i + j*_blockSize.width)*_binsPerCell] = cellsDescriptor[index][orientation] * gaussianFactor;
+                        descriptorVector[orientation + (i + j*_blockSize.width)*_binsPerCell] = cellDescriptor[orientation] * gaussianFactor;
                 }
 
             // We need the norm for the current block descriptor
             float invNorm = 1.f / getDescriptorNorm(descriptorVector);
 
             // And we scale the whole block, to get the descriptor for the current cell
-            for (int i = 0; i < _binsPerCell * (_blockSize.width*_blockSize.height); ++i)
-                descriptor.push_back(descriptorVector[i] * invNorm);
+            for (int i = 0; i < blockBins; ++i)
+                descriptorVector[i] *= invNorm;
+
+            descriptorIndex += blockBins;
         }
 
     return descriptor;
 }
 
+/*************/
+void Descriptor_Hog::getCellHistogram(cv::Point_<int> pTopLeft, const cv::Size_<int> pCellSize, float* pHistogram) const
+{
+    for (int i = 0; i < _binsPerCell; ++i)
+        pHistogram[i] = 0.f;
+
+    for (int y = pTopLeft.y; y < pTopLeft.y + pCellSize.height; ++y)
+    {
+        const cv::Vec2b* gradients = _gradients.ptr<cv::Vec2b>(y);
+        for (int x = pTopLeft.x; x < pTopLeft.x + pCellSize.width; ++x)
+        {
+            const int angle = gradients[x][0];
+            const float length = gradients[x][1];
+            const float ratio = _binNeighbourWeight[angle];
+            pHistogram[_binIndex[angle]] += length * (1.f - ratio);
+            pHistogram[_binNeighbour[angle]] += length * ratio;
+        }
+    }
+
+    // We normalize the cell
+    float invNorm = 1.f / getDescriptorNorm(pHistogram);
+    for (int i = 0; i < _binsPerCell; ++i)
+        pHistogram[i] *= invNorm;
+}
+
+/*************/
+void Descriptor_Hog::updateBinning()
+{
+    // Angle covered per bin
+    float anglePerBin = 180.f / (float)_binsPerCell;
+    if (_signed)
+        anglePerBin *= 2.f;
+    float binPerAngle = 1.f / anglePerBin;
+
+    _binIndex.resize(256);
+    _binNeighbour.resize(256);
+    _binNeighbourWeight.resize(256);
+    for (int angle = 0; angle < 256; ++angle)
+    {
+        int index = min(_binsPerCell - 1, (int)(angle * binPerAngle));
+        float subPos = angle - index*anglePerBin;
+        int shift = (subPos < anglePerBin*0.5f) ? -1 : 1;
+        if (shift + index < 0)
+            shift = _binsPerCell-1;
+        else if (shift + index >= _binsPerCell)
+            shift = 0;
+        else
+            shift += index;
+
+        _binIndex[angle] = index;
+        _binNeighbour[angle] = shift;
+        _binNeighbourWeight[angle] = abs(subPos - anglePerBin*0.5f) * binPerAngle;
+    }
+}
+
+/*************/
+void Descriptor_Hog::updateBlockWeights()
+{
+    _blockWeights.assign(_blockSize.width * _blockSize.height, 1.f);
+    if (_gaussSigma == 0.f)
+        return;
+
+    for (int i = 0; i < _blockSize.width; ++i)
+        for (int j = 0; j < _blockSize.height; ++j)
+        {
+            float distToCenterBlock = sqrtf(pow((float)i - (float)_blockSize.width*0.5f + 0.5, 2.f) + pow((float)j - (float)_blockSize.height*0.5f + 0.5, 2.f));
+            _blockWeights[i + j*_blockSize.width] = getGaussian(distToCenterBlock, _gaussSigma);
+        }
+}
+
 /*************/
 void Descriptor_Hog::setRoi(cv::Rect_<int> pCropRect)
 {
@@ -286,6 +484,12 @@ void Descriptor_Hog::setHogParams(const cv::Size_<int> pDescriptorSize, const cv
     _normType = pNorm;
 
     _gaussSigma = max(0.f, pSigma);
+
+    updateBinning();
+    updateBlockWeights();
+
+    // The cell histograms will be computed again with the next image
+    _cellGrids.clear();
 }
 
 /*************/
@@ -294,10 +498,18 @@ void Descriptor_Hog::setMultiscaleParams(const cv::Size_<int> pCellMinSize, cons
     _cellMinSize = pCellMinSize;
     _cellMaxSize = pCellMaxSize;
     _cellStep = pCellStep;
+
+    _cellGrids.clear();
 }
 
 /*************/
 float Descriptor_Hog::getDescriptorNorm(vector<float> pDescriptor) const
+{
+    return getDescriptorNorm(pDescriptor.data());
+}
+
+/*************/
+float Descriptor_Hog::getDescriptorNorm(const float* pDescriptor) const
 {
     float norm;
 
@@ -311,7 +523,7 @@ float Descriptor_Hog::getDescriptorNorm(vector<float> pDescriptor) const
     {
         norm = _epsilon;
         for (int i = 0; i < _binsPerCell; ++i)
-            norm += pow(pDescriptor[i], 2.f);
+            norm += pDescriptor[i] * pDescriptor[i];
 
         norm = sqrtf(norm);
     }
@@ -0,0 +1,126 @@
+#include "framewriter.h"
+
+#include <glib.h>
+
+using namespace std;
+
+/*************/
+FrameWriter::FrameWriter(unsigned int pThreads, unsigned int pQueueSize)
+{
+    mQueueSize = max(1u, pQueueSize);
+    mStop = false;
+    mDropPolicy = dropNewest;
+    mDropped = 0;
+    mWritten = 0;
+
+    setFormat("png");
+
+    for (unsigned int i = 0; i < max(1u, pThreads); ++i)
+        mThreads.push_back(thread(&FrameWriter::encode, this));
+}
+
+/*************/
+FrameWriter::~FrameWriter()
+{
+    {
+        lock_guard<mutex> lock(mMutex);
+        mStop = true;
+    }
+    mCondition.notify_all();
+
+    for (auto& t : mThreads)
+        t.join();
+}
+
+/*************/
+bool FrameWriter::write(const cv::Mat& pFrame, const string& pBasename)
+{
+    if (pFrame.total() == 0)
+        return true;
+
+    bool accepted = true;
+    {
+        lock_guard<mutex> lock(mMutex);
+
+        if (mQueue.size() >= mQueueSize)
+        {
+            mDropped++;
+            accepted = false;
+            if (mDropPolicy == dropNewest)
+                return false;
+            mQueue.pop_front();
+        }
+
+        // The copy is only done once we know the frame will be written
+        Job job;
+        job.frame = pFrame.clone();
+        job.filename = pBasename + string(".") + mExtension;
+        job.params = mParams;
+        mQueue.push_back(job);
+    }
+    mCondition.notify_one();
+
+    return accepted;
+}
+
+/*************/
+void FrameWriter::setFormat(const string& pExtension, int pCompression)
+{
+    lock_guard<mutex> lock(mMutex);
+
+    mExtension = pExtension;
+    mParams.clear();
+    if (pCompression < 0)
+        return;
+
+    if (pExtension == "png")
+    {
+        mParams.push_back(CV_IMWRITE_PNG_COMPRESSION);
+        mParams.push_back(min(9, pCompression));
+    }
+    else if (pExtension == "jpg" || pExtension == "jpeg")
+    {
+        mParams.push_back(CV_IMWRITE_JPEG_QUALITY);
+        mParams.push_back(min(100, pCompression));
+    }
+    else if (pExtension == "ppm" || pExtension == "pgm" || pExtension == "pbm")
+    {
+        mParams.push_back(CV_IMWRITE_PXM_BINARY);
+        mParams.push_back(pCompression > 0 ? 1 : 0);
+    }
+}
+
+/*************/
+void FrameWriter::encode()
+{
+    while (true)
+    {
+        Job job;
+        {
+            unique_lock<mutex> lock(mMutex);
+            while (!mStop && mQueue.empty())
+                mCondition.wait(lock);
+
+            // Remaining frames are written before stopping
+            if (mQueue.empty())
+                return;
+
+            job = mQueue.front();
+            mQueue.pop_front();
+        }
+
+        bool result = false;
+        try
+        {
+            result = cv::imwrite(job.filename, job.frame, job.params);
+        }
+        catch (cv::Exception)
+        {
+        }
+
+        if (result)
+            mWritten++;
+        else
+            g_log(NULL, G_LOG_LEVEL_WARNING, "FrameWriter - Unable to write %s", job.filename.c_str());
+    }
+}
@@ -1,23 +1,145 @@
 #include "hdribuilder.h"
 
+#include <limits>
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
 using namespace std;
 using namespace cv;
 
-#define MAX_WEIGHT 1e10
+// Number of incremental updates after which the running sums are recomputed,
+// to prevent rounding errors from accumulating
+#define MAX_UPDATES 64
+
+/*************/
+// Adds the contribution of an LDRi to the running sums
+class Parallel_Accumulate : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Accumulate(const Mat* image, const double* valueLUT, const double* weightLUT, Mat* valueSum, Mat* weightSum):
+            _image(image), _valueLUT(valueLUT), _weightLUT(weightLUT), _valueSum(valueSum), _weightSum(weightSum) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const int length = _image->cols * 3;
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const uchar* pixels = _image->ptr<uchar>(y);
+                double* values = _valueSum->ptr<double>(y);
+                double* weights = _weightSum->ptr<double>(y);
+                int x = 0;
+#if CV_SSE2
+                for (; x + 4 <= length; x += 4)
+                {
+                    const uchar v0 = pixels[x], v1 = pixels[x + 1], v2 = pixels[x + 2], v3 = pixels[x + 3];
+                    _mm_storeu_pd(values + x, _mm_add_pd(_mm_loadu_pd(values + x), _mm_set_pd(_valueLUT[v1], _valueLUT[v0])));
+                    _mm_storeu_pd(values + x + 2, _mm_add_pd(_mm_loadu_pd(values + x + 2), _mm_set_pd(_valueLUT[v3], _valueLUT[v2])));
+                    _mm_storeu_pd(weights + x, _mm_add_pd(_mm_loadu_pd(weights + x), _mm_set_pd(_weightLUT[v1], _weightLUT[v0])));
+                    _mm_storeu_pd(weights + x + 2, _mm_add_pd(_mm_loadu_pd(weights + x + 2), _mm_set_pd(_weightLUT[v3], _weightLUT[v2])));
+                }
+#endif
+                for (; x < length; ++x)
+                {
+                    uchar v = pixels[x];
+                    values[x] += _valueLUT[v];
+                    weights[x] += _weightLUT[v];
+                }
+            }
+        }
+
+    private:
+        const Mat* _image;
+        const double* _valueLUT;
+        const double* _weightLUT;
+        Mat* _valueSum;
+        Mat* _weightSum;
+};
+
+/*************/
+// Computes the HDRi from the running sums, then handles over and under exposed pixels
+class Parallel_Compose : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Compose(const LDRi* lowest, const LDRi* highest, const Mat* valueSum, const Mat* weightSum, const double minWeight, Mat* hdri):
+            _lowest(lowest), _highest(highest), _valueSum(valueSum), _weightSum(weightSum), _minWeight(minWeight), _hdri(hdri)
+        {
+            _overValue = 255.f / 127.f * pow(2.f, _highest->EV);
+            _underScale = 1.f / 127.f * pow(2.f, _lowest->EV);
+        }
+
+        void operator()(const cv::Range& r) const
+        {
+            const int length = _hdri->cols * 3;
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const double* values = _valueSum->ptr<double>(y);
+                const double* weights = _weightSum->ptr<double>(y);
+                float* output = _hdri->ptr<float>(y);
+
+                // We divide by the sum of gaussians to get the final values
+                // Pixels with a null weight, up to the rounding residuals of the updates, are set to 0
+                int x = 0;
+#if CV_SSE2
+                const __m128d minWeight = _mm_set1_pd(_minWeight);
+                for (; x + 4 <= length; x += 4)
+                {
+                    __m128d weightLow = _mm_loadu_pd(weights + x);
+                    __m128d weightHigh = _mm_loadu_pd(weights + x + 2);
+                    __m128d low = _mm_and_pd(_mm_div_pd(_mm_loadu_pd(values + x), _mm_max_pd(weightLow, minWeight)), _mm_cmpgt_pd(weightLow, minWeight));
+                    __m128d high = _mm_and_pd(_mm_div_pd(_mm_loadu_pd(values + x + 2), _mm_max_pd(weightHigh, minWeight)), _mm_cmpgt_pd(weightHigh, minWeight));
+                    _mm_storeu_ps(output + x, _mm_movelh_ps(_mm_cvtpd_ps(low), _mm_cvtpd_ps(high)));
+                }
+#endif
+                for (; x < length; ++x)
+                    output[x] = weights[x] > _minWeight ? (float)(values[x] / weights[x]) : 0.f;
+
+                const uchar* highest = _highest->image.ptr<uchar>(y);
+                const uchar* lowest = _lowest->image.ptr<uchar>(y);
+                for (x = 0; x < length; x += 3)
+                {
+                    // If the least exposed channel is overexposed on one channel
+                    // we set the pixel to white
+                    if (highest[x] == 255 || highest[x + 1] == 255 || highest[x + 2] == 255)
+                    {
+                        output[x] = output[x + 1] = output[x + 2] = _overValue;
+                    }
+                    // If the most exposed channel is underexposed on one channel
+                    // we set the pixel to (almost) black
+                    else if (lowest[x] < 64 && lowest[x + 1] < 64 && lowest[x + 2] < 64)
+                    {
+                        // We will stick to N&B in this case
+                        float value = (0.263f * (float)lowest[x] + 0.655f * (float)lowest[x + 1] + 0.082f * (float)lowest[x + 2]) * _underScale;
+                        output[x] = output[x + 1] = output[x + 2] = value;
+                    }
+                }
+            }
+        }
+
+    private:
+        const LDRi* _lowest;
+        const LDRi* _highest;
+        const Mat* _valueSum;
+        const Mat* _weightSum;
+        const double _minWeight;
+        Mat* _hdri;
+        float _overValue;
+        float _underScale;
+};
 
 /*************/
 HdriBuilder::HdriBuilder()
 {
     mContinuous = false;
-
-    mMinSum = 0.1f;
-    mMinExposureIndex = 0;
-    mMaxExposureIndex = 0;
+    mUpdateCount = 0;
 
     mHDRi.create(0, 0, CV_32FC3);
 
-    for (uchar i = 0; i < 255; ++i)
+    for (int i = 0; i < 255; ++i)
         mGaussianLUT[i] = getGaussian(i);
+    // Saturated values carry no information
+    mGaussianLUT[255] = 0.f;
 }
 
 /*************/
@@ -28,51 +150,54 @@ HdriBuilder::~HdriBuilder()
 /*************/
 bool HdriBuilder::addLDR(const Mat& pImage, float pEV)
 {
+    if (pImage.type() != CV_8UC3)
+        return false;
+
     LDRi lLDRi;
 
     lLDRi.EV = pEV;
-    lLDRi.image = pImage;
+    // The image is copied, as the caller may reuse its buffer
+    lLDRi.image = pImage.clone();
+    lLDRi.valueLUT.resize(256);
+    float lExposure = pow(2.0f, pEV);
+    for (int i = 0; i < 256; ++i)
+        lLDRi.valueLUT[i] = mGaussianLUT[i] * (float)i / 127.f * lExposure;
 
     // Check if the size has changed
     if (mLDRi.size() != 0 && mLDRi[0].image.size() != lLDRi.image.size())
         mLDRi.clear();
 
     // Check if this is the first image
-    if(mLDRi.size() == 0)
+    if (mLDRi.size() == 0)
     {
         mLDRi.push_back(lLDRi);
+        resetSums();
         return true;
     }
-    // If not, we must check the width and height
-    // as they must be the same
-    else
+
+    for (int i = 0; i < (int)mLDRi.size(); i++)
     {
-        if(lLDRi.image.cols != mLDRi[0].image.cols)
-        {
-            return false;
-        }
-        if(lLDRi.image.rows != mLDRi[0].image.rows)
-        {
-            return false;
-        }
+        if (mLDRi[i].EV != lLDRi.EV)
+            continue;
 
-        bool lResult = true;
-        for(int i=0; i<(int)mLDRi.size(); i++)
+        // Only the contribution of the replaced image is updated
+        if (mContinuous)
         {
-            if(mLDRi[i].EV == lLDRi.EV && mContinuous)
-            {
-                mLDRi[i] = lLDRi;
-                lResult = false;
-            }
-            else if (mLDRi[i].EV == lLDRi.EV)
-                lResult = false;
+            accumulate(mLDRi[i], -1.f);
+            accumulate(lLDRi, 1.f);
+            mLDRi[i] = lLDRi;
+            mUpdateCount++;
         }
+        return false;
+    }
 
-        if(lResult)
-            mLDRi.push_back(lLDRi);
+    auto position = upper_bound(mLDRi.begin(), mLDRi.end(), lLDRi, [&] (const LDRi& a, const LDRi& b) {
+        return a.EV < b.EV;
+    });
+    accumulate(lLDRi, 1.f);
+    mLDRi.insert(position, lLDRi);
 
-        return lResult;
-    }
+    return true;
 }
 
 /*************/
@@ -88,107 +213,47 @@ bool HdriBuilder::computeHDRI()
     if(mLDRi.size() == 0)
         return false;
 
+    if (mUpdateCount >= MAX_UPDATES)
+        resetSums();
+
     // HDRi the same size as LDRi, but RGB32f
     mHDRi.create(mLDRi[0].image.rows, mLDRi[0].image.cols, CV_32FC3);
 
-    // Ordering images
-    sort(mLDRi.begin(), mLDRi.end(), [&] (LDRi a, LDRi b)
-    {
-        return a.EV < b.EV;
-    });
-
-    // Convert all LDRi to floating, exposure corrected LDRi
-    for_each (mLDRi.begin(), mLDRi.end(), [&] (LDRi& ldri)
-    {
-        if (ldri.imagef.total() > 0 && ldri.w.total() > 0)
-            return;
+    // Each replacement of an LDRi subtracts then adds weights of at most 1 to sums of at most mLDRi.size(),
+    // leaving a rounding residual below this value where the weight should be null
+    double minWeight = 2.0 * numeric_limits<double>::epsilon() * (double)mUpdateCount * (double)mLDRi.size();
 
-        ldri.imagef = cv::Mat::zeros(ldri.image.rows, ldri.image.cols, CV_32FC3);
-        ldri.w = cv::Mat::zeros(ldri.image.rows, ldri.image.cols, CV_32FC3);
+    // LDRi are sorted by EV
+    cv::parallel_for_(cv::Range(0, mHDRi.rows), Parallel_Compose(&mLDRi[0], &mLDRi[mLDRi.size() - 1], &mValueSum, &mWeightSum, minWeight, &mHDRi));
 
-        for (uint x = 0; x < (uint)mHDRi.cols; ++x)
-            for (uint y = 0; y < (uint)mHDRi.rows; ++y)
-            {
-                unsigned char lLDRPixel;
-                float lCoeff;
+    if (!mContinuous)
+        mLDRi.clear();
 
-                for(unsigned int channel=0; channel<3; channel++)
-                {
-                    lLDRPixel = ldri.image.at<Vec3b>(y, x)[channel];
-                    lCoeff = mGaussianLUT[lLDRPixel];
-                    ldri.w.at<Vec3f>(y, x)[channel] = lCoeff;
-                    ldri.imagef.at<Vec3f>(y, x)[channel] = lCoeff*(float)lLDRPixel/127.f*pow(2.0f, ldri.EV);
-                }
-            }
-    });
+    return true;
+}
 
-    // Calculation of each HDR pixel
-    for(unsigned int x=0; x<(unsigned int)mHDRi.cols; x++)
+/*************/
+void HdriBuilder::accumulate(const LDRi& pLDRi, float pSign)
+{
+    double lValueLUT[256], lWeightLUT[256];
+    for (int i = 0; i < 256; ++i)
     {
-        for(unsigned int y=0; y<(unsigned int)mHDRi.rows; y++)
-        {
-            float lHDRPixel[3], lSum[3];
-            lHDRPixel[0] = 0.f;
-            lHDRPixel[1] = 0.f;
-            lHDRPixel[2] = 0.f;
-            lSum[0] = numeric_limits<float>::min();
-            lSum[1] = numeric_limits<float>::min();
-            lSum[2] = numeric_limits<float>::min();
-
-            // If the least exposed channel is overexposed on one channel
-            // we set the pixel to white
-            if(mLDRi[mLDRi.size()-1].image.at<Vec3b>(y, x)[0] == 255
-                    || mLDRi[mLDRi.size()-1].image.at<Vec3b>(y, x)[1] == 255
-                    || mLDRi[mLDRi.size()-1].image.at<Vec3b>(y, x)[2] == 255)
-            {
-                for(unsigned char channel=0; channel<3; channel++)
-                {
-                    lHDRPixel[channel] = 255.f/127.f*pow(2.0f, mLDRi[mLDRi.size()-1].EV);
-                    lSum[channel] = 1.f;
-                }
-            }
-            // If the most exposed channel is underexposed on one channel
-            // we set the pixel to (almost) black
-            else if(mLDRi[0].image.at<Vec3b>(y, x)[0] < 64
-                    && mLDRi[0].image.at<Vec3b>(y, x)[1] < 64
-                    && mLDRi[0].image.at<Vec3b>(y, x)[2] < 64)
-            {
-                // We will stick to N&B in this case
-                float lValue = 0.263f*(float)mLDRi[0].image.at<Vec3b>(y, x)[0]
-                        + 0.655f*(float)mLDRi[0].image.at<Vec3b>(y, x)[1]
-                        + 0.082f*(float)mLDRi[0].image.at<Vec3b>(y, x)[2];
-                for(unsigned char channel=0; channel<3; channel++)
-                {
-                    lHDRPixel[channel] = lValue/127.f*pow(2.0f, mLDRi[0].EV);
-                    lSum[channel] = 1.f;
-                }
-            }
-            // else, we add the contribution of each image
-            else
-            {
-                for(unsigned int index=0; index<mLDRi.size(); index++)
-                    for(unsigned int channel=0; channel<3; channel++)
-                    {
-                        lHDRPixel[channel] += mLDRi[index].imagef.at<Vec3f>(y, x)[channel];
-                        lSum[channel] += mLDRi[index].w.at<Vec3f>(y, x)[channel];
-                    }
-            }
-
-            // We divide by the sum of gaussians to get the final values
-            lHDRPixel[0] /= lSum[0];
-            lHDRPixel[1] /= lSum[1];
-            lHDRPixel[2] /= lSum[2];
-
-            mHDRi.at<Vec3f>(y, x)[0] = lHDRPixel[0];
-            mHDRi.at<Vec3f>(y, x)[1] = lHDRPixel[1];
-            mHDRi.at<Vec3f>(y, x)[2] = lHDRPixel[2];
-        }
+        lValueLUT[i] = pSign * pLDRi.valueLUT[i];
+        lWeightLUT[i] = pSign * mGaussianLUT[i];
     }
 
-    if (!mContinuous)
-        mLDRi.clear();
+    cv::parallel_for_(cv::Range(0, pLDRi.image.rows), Parallel_Accumulate(&pLDRi.image, lValueLUT, lWeightLUT, &mValueSum, &mWeightSum));
+}
 
-    return true;
+/*************/
+void HdriBuilder::resetSums()
+{
+    mValueSum = Mat::zeros(mLDRi[0].image.rows, mLDRi[0].image.cols, CV_64FC3);
+    mWeightSum = Mat::zeros(mLDRi[0].image.rows, mLDRi[0].image.cols, CV_64FC3);
+    mUpdateCount = 0;
+
+    for (auto& ldri : mLDRi)
+        accumulate(ldri, 1.f);
 }
 
 /*************/
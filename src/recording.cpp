@@ -0,0 +1,301 @@
+#include "recording.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <glib.h>
+
+using namespace std;
+
+#define RECORDING_MAGIC "BLOBREC1"
+#define RECORDING_CHUNK (64 << 20)
+#define RECORDING_ALIGN 16
+
+namespace
+{
+    // Both headers are kept 16 bytes aligned, so that frame data is too
+    struct FileHeader
+    {
+        char magic[8];
+        uint64_t frames;
+        uint64_t end; //!< End of the last complete frame record
+        uint64_t reserved;
+    };
+
+    struct FrameHeader
+    {
+        uint64_t timestamp;
+        int32_t rows;
+        int32_t cols;
+        int32_t type;
+        int32_t reserved;
+        uint64_t size; //!< Size of the pixel data, padding excluded
+    };
+
+    size_t alignSize(size_t pSize)
+    {
+        return (pSize + RECORDING_ALIGN - 1) & ~(size_t)(RECORDING_ALIGN - 1);
+    }
+}
+
+/*************/
+RecordingWriter::RecordingWriter()
+{
+    mFile = -1;
+    mMap = NULL;
+    mMapSize = 0;
+    mEnd = 0;
+    mFrames = 0;
+}
+
+/*************/
+RecordingWriter::~RecordingWriter()
+{
+    close();
+}
+
+/*************/
+bool RecordingWriter::open(const string& pFilename)
+{
+    close();
+
+    mFile = ::open(pFilename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (mFile < 0)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingWriter - Unable to create file %s", pFilename.c_str());
+        return false;
+    }
+
+    mEnd = sizeof(FileHeader);
+    mFrames = 0;
+    if (!reserve(RECORDING_CHUNK))
+    {
+        ::close(mFile);
+        mFile = -1;
+        return false;
+    }
+
+    FileHeader* header = (FileHeader*)mMap;
+    memcpy(header->magic, RECORDING_MAGIC, sizeof(header->magic));
+    header->frames = 0;
+    header->end = mEnd;
+    header->reserved = 0;
+
+    return true;
+}
+
+/*************/
+void RecordingWriter::close()
+{
+    if (mMap != NULL)
+    {
+        munmap(mMap, mMapSize);
+        mMap = NULL;
+    }
+
+    if (mFile >= 0)
+    {
+        // The file is grown by chunks, the unused end is removed
+        if (ftruncate(mFile, mEnd) != 0)
+            g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingWriter - Unable to truncate the recording");
+        ::close(mFile);
+        mFile = -1;
+    }
+
+    mMapSize = 0;
+}
+
+/*************/
+bool RecordingWriter::reserve(size_t pSize)
+{
+    if (pSize <= mMapSize)
+        return true;
+
+    size_t size = max(mMapSize * 2, (pSize + RECORDING_CHUNK - 1) / RECORDING_CHUNK * RECORDING_CHUNK);
+
+    if (mMap != NULL)
+    {
+        munmap(mMap, mMapSize);
+        mMap = NULL;
+    }
+
+    if (ftruncate(mFile, size) != 0)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingWriter - Unable to grow the recording to %lu bytes", (unsigned long)size);
+        return false;
+    }
+
+    void* map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, mFile, 0);
+    if (map == MAP_FAILED)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingWriter - Unable to map the recording");
+        mMapSize = 0;
+        return false;
+    }
+
+    mMap = (uchar*)map;
+    mMapSize = size;
+    return true;
+}
+
+/*************/
+bool RecordingWriter::write(const cv::Mat& pFrame, unsigned long long pTimestamp)
+{
+    if (mFile < 0 || pFrame.total() == 0)
+        return false;
+
+    const size_t lineSize = pFrame.cols * pFrame.elemSize();
+    const size_t dataSize = lineSize * pFrame.rows;
+    const size_t recordSize = sizeof(FrameHeader) + alignSize(dataSize);
+
+    if (!reserve(mEnd + recordSize))
+    {
+        close();
+        return false;
+    }
+
+    FrameHeader* frame = (FrameHeader*)(mMap + mEnd);
+    frame->timestamp = pTimestamp;
+    frame->rows = pFrame.rows;
+    frame->cols = pFrame.cols;
+    frame->type = pFrame.type();
+    frame->reserved = 0;
+    frame->size = dataSize;
+
+    uchar* data = mMap + mEnd + sizeof(FrameHeader);
+    if (pFrame.isContinuous())
+        memcpy(data, pFrame.data, dataSize);
+    else
+        for (int y = 0; y < pFrame.rows; ++y)
+            memcpy(data + y * lineSize, pFrame.ptr(y), lineSize);
+
+    mEnd += recordSize;
+    mFrames++;
+
+    // The header is updated last, so that an interrupted recording stays readable
+    FileHeader* header = (FileHeader*)mMap;
+    header->frames = mFrames;
+    header->end = mEnd;
+
+    return true;
+}
+
+/*************/
+RecordingReader::RecordingReader()
+{
+    mFile = -1;
+    mMap = NULL;
+    mMapSize = 0;
+}
+
+/*************/
+RecordingReader::~RecordingReader()
+{
+    close();
+}
+
+/*************/
+bool RecordingReader::open(const string& pFilename)
+{
+    close();
+
+    mFile = ::open(pFilename.c_str(), O_RDONLY);
+    if (mFile < 0)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingReader - Unable to open file %s", pFilename.c_str());
+        return false;
+    }
+
+    struct stat fileStat;
+    if (fstat(mFile, &fileStat) != 0 || (size_t)fileStat.st_size < sizeof(FileHeader))
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingReader - File %s is not a recording", pFilename.c_str());
+        close();
+        return false;
+    }
+
+    mMapSize = fileStat.st_size;
+    void* map = mmap(NULL, mMapSize, PROT_READ, MAP_SHARED, mFile, 0);
+    if (map == MAP_FAILED)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingReader - Unable to map file %s", pFilename.c_str());
+        mMapSize = 0;
+        close();
+        return false;
+    }
+    mMap = (uchar*)map;
+
+    // Frames are mostly read in order
+    madvise(mMap, mMapSize, MADV_SEQUENTIAL);
+
+    const FileHeader* header = (const FileHeader*)mMap;
+    if (memcmp(header->magic, RECORDING_MAGIC, sizeof(header->magic)) != 0)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingReader - File %s is not a recording", pFilename.c_str());
+        close();
+        return false;
+    }
+
+    // Only complete records are indexed
+    size_t end = min((size_t)header->end, mMapSize);
+    size_t offset = sizeof(FileHeader);
+    while (offset + sizeof(FrameHeader) <= end)
+    {
+        const FrameHeader* frame = (const FrameHeader*)(mMap + offset);
+        size_t recordSize = sizeof(FrameHeader) + alignSize(frame->size);
+        if (frame->rows <= 0 || frame->cols <= 0 || offset + recordSize > end
+            || frame->size != (uint64_t)frame->rows * frame->cols * CV_ELEM_SIZE(frame->type))
+            break;
+
+        mFrames.push_back(offset);
+        offset += recordSize;
+    }
+
+    if (mFrames.size() < header->frames)
+        g_log(NULL, G_LOG_LEVEL_WARNING, "RecordingReader - Only %lu frames out of %lu could be read from %s", (unsigned long)mFrames.size(),
+            (unsigned long)header->frames, pFilename.c_str());
+
+    return true;
+}
+
+/*************/
+void RecordingReader::close()
+{
+    if (mMap != NULL)
+    {
+        munmap(mMap, mMapSize);
+        mMap = NULL;
+    }
+
+    if (mFile >= 0)
+    {
+        ::close(mFile);
+        mFile = -1;
+    }
+
+    mMapSize = 0;
+    mFrames.clear();
+}
+
+/*************/
+cv::Mat RecordingReader::getFrame(size_t pIndex) const
+{
+    if (pIndex >= mFrames.size())
+        return cv::Mat();
+
+    const FrameHeader* frame = (const FrameHeader*)(mMap + mFrames[pIndex]);
+    return cv::Mat(frame->rows, frame->cols, frame->type, (void*)(mMap + mFrames[pIndex] + sizeof(FrameHeader)));
+}
+
+/*************/
+unsigned long long RecordingReader::getTimestamp(size_t pIndex) const
+{
+    if (pIndex >= mFrames.size())
+        return 0;
+
+    return ((const FrameHeader*)(mMap + mFrames[pIndex]))->timestamp;
+}
@@ -1,7 +1,87 @@
 #include "source_2d.h"
 
+#include <algorithm>
+#include <chrono>
+
 using namespace std;
 
+/*************/
+// Recursive temporal filter, with a motion gate
+// The running average is stored with TEMPORAL_SHIFT fractional bits
+/*************/
+#define TEMPORAL_SHIFT 6
+
+#if CV_SSE2
+static inline __m128i temporalUpdate(__m128i value, __m128i acc, __m128i weight, __m128i threshold)
+{
+    __m128i diff = _mm_sub_epi16(value, acc);
+    __m128i absDiff = _mm_max_epi16(diff, _mm_sub_epi16(_mm_setzero_si128(), diff));
+    __m128i moving = _mm_cmpgt_epi16(absDiff, threshold);
+    // (2 * diff * weight) >> 16, weight being the new frame weight scaled by 2^15
+    __m128i smoothed = _mm_add_epi16(acc, _mm_mulhi_epi16(_mm_slli_epi16(diff, 1), weight));
+    return _mm_or_si128(_mm_and_si128(moving, value), _mm_andnot_si128(moving, smoothed));
+}
+#endif
+
+class Parallel_TemporalFilter : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_TemporalFilter(cv::Mat* image, cv::Mat* accumulator, short weight, short threshold):
+            _image(image), _accumulator(accumulator), _weight(weight), _threshold(threshold) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const int length = _image->cols * _image->channels();
+            const int half = 1 << (TEMPORAL_SHIFT - 1);
+
+            for (int y = r.start; y < r.end; ++y)
+            {
+                uchar* pixels = _image->ptr<uchar>(y);
+                short* acc = _accumulator->ptr<short>(y);
+                int x = 0;
+#if CV_SSE2
+                const __m128i zero = _mm_setzero_si128();
+                const __m128i weight = _mm_set1_epi16(_weight);
+                const __m128i threshold = _mm_set1_epi16(_threshold);
+                const __m128i round = _mm_set1_epi16(half);
+                for (; x + 16 <= length; x += 16)
+                {
+                    __m128i input = _mm_loadu_si128((const __m128i*)(pixels + x));
+                    __m128i lo = _mm_slli_epi16(_mm_unpacklo_epi8(input, zero), TEMPORAL_SHIFT);
+                    __m128i hi = _mm_slli_epi16(_mm_unpackhi_epi8(input, zero), TEMPORAL_SHIFT);
+                    __m128i accLo = temporalUpdate(lo, _mm_loadu_si128((const __m128i*)(acc + x)), weight, threshold);
+                    __m128i accHi = temporalUpdate(hi, _mm_loadu_si128((const __m128i*)(acc + x + 8)), weight, threshold);
+                    _mm_storeu_si128((__m128i*)(acc + x), accLo);
+                    _mm_storeu_si128((__m128i*)(acc + x + 8), accHi);
+
+                    __m128i outLo = _mm_srai_epi16(_mm_add_epi16(accLo, round), TEMPORAL_SHIFT);
+                    __m128i outHi = _mm_srai_epi16(_mm_add_epi16(accHi, round), TEMPORAL_SHIFT);
+                    _mm_storeu_si128((__m128i*)(pixels + x), _mm_packus_epi16(outLo, outHi));
+                }
+#endif
+                for (; x < length; ++x)
+                {
+                    int value = pixels[x] << TEMPORAL_SHIFT;
+                    int diff = value - acc[x];
+                    if (abs(diff) > _threshold)
+                        acc[x] = value;
+                    else
+                        acc[x] += (2 * diff * _weight) >> 16;
+                    pixels[x] = cv::saturate_cast<uchar>((acc[x] + half) >> TEMPORAL_SHIFT);
+                }
+            }
+        }
+
+    private:
+        cv::Mat* _image;
+        cv::Mat* _accumulator;
+        short _weight;
+        short _threshold;
+};
+
+/*************/
+// Definition of class Source_2D
+/*************/
 std::string Source_2D::mClassName = "Source_2D";
 std::string Source_2D::mDocumentation = "N/A";
 
@@ -26,11 +106,15 @@ Source_2D::Source_2D()
     mGamma = 2.2f;
 
     mFilterNoise = false;
+    mFilterTemporal = false;
+    mTemporalWeight = 1.f;
+    mTemporalThreshold = 0.f;
 
     mGammaCorrection = false;
     mGammaCorrectionValue = 1.f;
 
     mScale = 1.f;
+    mRawScale = 1.f;
     mRotation = 0.f;
     mScaleValues = 1.f;
     mCrop = cv::Rect(0, 0, 0, 0);
@@ -55,10 +139,18 @@ Source_2D::Source_2D()
     mAutoExposureStep = 0.05f;
 
     mHdriActive = false;
+    mTonemapping = false;
 
     mSaveToFile = false;
     mSaveIndex = 0;
     mSavePhase = 0;
+    mSaveExtension = "png";
+    mSaveCompression = -1;
+    mSaveThreads = 2;
+    mSaveQueueSize = 16;
+    mSaveDropPolicy = FrameWriter::dropNewest;
+
+    initCorrectionStages();
 
     mIsRunning = true;
     mCorrectionThread.reset(new thread(&Source_2D::applyCorrections, this));
@@ -95,39 +187,56 @@ void Source_2D::applyCorrections()
 
             bool lResult = true;
             cv::Mat buffer = retrieveRawFrame();
-    
-            if (mAutoExposureRoi.width != 0 && mAutoExposureRoi.height != 0)
-                applyAutoExposure(buffer);
-            if (mMask.total() != 0)
-                applyMask(buffer);
-            // Noise filtering and vignetting correction, as well as ICC transform and lense
-            // distortion correction have to be done before any geometric transformation
-            if (mFilterNoise)
-                filterNoise(buffer);
-            if (mCorrectVignetting)
-                correctVignetting(buffer);
-            if (mICCTransform != NULL)
-                cmsDoTransform(mICCTransform, buffer.data, buffer.data, buffer.total());
-            if (mGammaCorrection)
-                correctGamma(buffer);
-            if (mCorrectDistortion)
-                correctDistortion(buffer);
-            if (mCorrectFisheye)
-                correctFisheye(buffer);
-            if (mScale != 1.f)
-                scale(buffer);
-            if (mRotation != 0.f)
-                rotate(buffer);
-            if (mCrop.width != 0)
-                crop(buffer);
-            if (mScaleValues != 1.f)
-                buffer *= mScaleValues;
-            if (mHdriActive)
-                lResult &= createHdri(buffer);
+            int scratch = 0;
+
+            // Raw frames are recorded before any correction
+            if (mRecorder.isOpen())
+                mRecorder.write(buffer, chrono::duration_cast<chrono::microseconds>(chrono::system_clock::now().time_since_epoch()).count());
+
+            for (auto& stage : mCorrectionStages)
+            {
+                if (!stage.enabled || !stage.isActive())
+                    continue;
+
+                auto start = chrono::high_resolution_clock::now();
+                if (stage.inPlace)
+                {
+                    lResult = stage.apply(buffer, buffer);
+                }
+                else
+                {
+                    // The output goes to the scratch buffer not holding the input,
+                    // its allocation being reused from one frame to the next
+                    lResult = stage.apply(buffer, mScratchBuffers[scratch]);
+                    buffer = mScratchBuffers[scratch];
+                    scratch = (scratch + 1) % 2;
+                }
+                stage.duration += chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count();
+                stage.calls++;
+
+                if (!lResult || buffer.total() == 0)
+                    break;
+            }
     
             // Some modifiers will not output a valid image every frame
+            // The result is handed off instead of copied: raw frames are fresh for each frame, and when the
+            // result is a scratch buffer, the previous corrected frame takes its place if no capture still uses it
             if (buffer.rows != 0 && buffer.cols != 0 && lResult)
-                mCorrectedBuffer = buffer.clone();
+            {
+                int slot = -1;
+                for (int i = 0; i < 2; ++i)
+                    if (buffer.data == mScratchBuffers[i].data)
+                        slot = i;
+
+                if (slot == -1)
+                    mCorrectedBuffer = buffer;
+                else
+                {
+                    swap(mCorrectedBuffer, mScratchBuffers[slot]);
+                    if (mScratchBuffers[slot].refcount == NULL || *mScratchBuffers[slot].refcount > 1)
+                        mScratchBuffers[slot].release();
+                }
+            }
     
             if (mSaveToFile)
                 saveToFile(buffer);
@@ -139,6 +248,81 @@ void Source_2D::applyCorrections()
     }
 }
 
+/************/
+void Source_2D::initCorrectionStages()
+{
+    // Default order. Noise filtering and vignetting correction, as well as ICC transform and lense
+    // distortion correction have to be done before any geometric transformation
+    addCorrectionStage("autoExposure", [&] () {return mAutoExposureRoi.width != 0 && mAutoExposureRoi.height != 0;},
+        [&] (cv::Mat& pImg, cv::Mat&) {applyAutoExposure(pImg); return true;}, true);
+    addCorrectionStage("mask", [&] () {return mMask.isSet();},
+        [&] (cv::Mat& pImg, cv::Mat&) {applyMask(pImg); return true;}, true);
+    addCorrectionStage("noiseFiltering", [&] () {return mFilterNoise;},
+        [&] (cv::Mat& pImg, cv::Mat& pOutput) {filterNoise(pImg, pOutput); return true;}, false);
+    addCorrectionStage("temporalFiltering", [&] () {return mFilterTemporal;},
+        [&] (cv::Mat& pImg, cv::Mat&) {filterTemporal(pImg); return true;}, true);
+    addCorrectionStage("vignetting", [&] () {return mCorrectVignetting;},
+        [&] (cv::Mat& pImg, cv::Mat&) {correctVignetting(pImg); return true;}, true);
+    addCorrectionStage("iccInputProfile", [&] () {return mICCTransform != NULL;},
+        [&] (cv::Mat& pImg, cv::Mat&) {cmsDoTransform(mICCTransform, pImg.data, pImg.data, pImg.total()); return true;}, true);
+    addCorrectionStage("gammaCorrection", [&] () {return mGammaCorrection;},
+        [&] (cv::Mat& pImg, cv::Mat&) {correctGamma(pImg); return true;}, true);
+    addCorrectionStage("distortion", [&] () {return mCorrectDistortion;},
+        [&] (cv::Mat& pImg, cv::Mat& pOutput) {correctDistortion(pImg, pOutput); return true;}, false);
+    addCorrectionStage("fisheye", [&] () {return mCorrectFisheye;},
+        [&] (cv::Mat& pImg, cv::Mat& pOutput) {correctFisheye(pImg, pOutput); return true;}, false);
+    addCorrectionStage("scale", [&] () {return mScale != mRawScale;},
+        [&] (cv::Mat& pImg, cv::Mat& pOutput) {scale(pImg, pOutput); return true;}, false);
+    addCorrectionStage("rotation", [&] () {return mRotation != 0.f;},
+        [&] (cv::Mat& pImg, cv::Mat& pOutput) {rotate(pImg, pOutput); return true;}, false);
+    addCorrectionStage("crop", [&] () {return mCrop.width != 0;},
+        [&] (cv::Mat& pImg, cv::Mat&) {crop(pImg); return true;}, true);
+    addCorrectionStage("scaleValues", [&] () {return mScaleValues != 1.f;},
+        [&] (cv::Mat& pImg, cv::Mat&) {pImg *= mScaleValues; return true;}, true);
+    addCorrectionStage("hdri", [&] () {return mHdriActive;},
+        [&] (cv::Mat& pImg, cv::Mat&) {return createHdri(pImg);}, true);
+    addCorrectionStage("tonemapping", [&] () {return mTonemapping;},
+        [&] (cv::Mat& pImg, cv::Mat&) {mTonemapper.process(pImg, pImg); return true;}, true);
+}
+
+/************/
+void Source_2D::addCorrectionStage(string pName, function<bool()> pIsActive, function<bool(cv::Mat&, cv::Mat&)> pApply, bool pInPlace)
+{
+    CorrectionStage stage;
+    stage.name = pName;
+    stage.isActive = pIsActive;
+    stage.apply = pApply;
+    stage.inPlace = pInPlace;
+    stage.enabled = true;
+    stage.duration = 0;
+    stage.calls = 0;
+
+    mCorrectionStages.push_back(stage);
+}
+
+/************/
+void Source_2D::setCorrectionOrder(vector<string> pNames)
+{
+    // Stages given in pNames are moved first, in this order.
+    // The others follow, in their previous relative order
+    vector<CorrectionStage> stages;
+    for (auto& name : pNames)
+    {
+        auto stage = find_if(mCorrectionStages.begin(), mCorrectionStages.end(), [&] (const CorrectionStage& s) {return s.name == name;});
+        if (stage == mCorrectionStages.end())
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Unknown correction stage: %s", mClassName.c_str(), name.c_str());
+            continue;
+        }
+        stages.push_back(*stage);
+        mCorrectionStages.erase(stage);
+    }
+
+    for (auto& stage : mCorrectionStages)
+        stages.push_back(stage);
+    mCorrectionStages = stages;
+}
+
 /************/
 Capture_Ptr Source_2D::retrieveFrame()
 {
@@ -167,8 +351,13 @@ void Source_2D::setBaseParameter(atom::Message pParam)
         if (!readParam(pParam, filename))
             return;
 
-        mMask = cv::imread(filename, CV_LOAD_IMAGE_GRAYSCALE);
-        cv::divide(255, mMask, mMask);
+        cv::Mat mask = cv::imread(filename, CV_LOAD_IMAGE_GRAYSCALE);
+        if (mask.total() == 0)
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Unable to load mask %s", mClassName.c_str(), filename.c_str());
+            return;
+        }
+        mMask.set(mask);
     }
     else if (paramName == "vignetting")
     {
@@ -211,6 +400,28 @@ void Source_2D::setBaseParameter(atom::Message pParam)
                 mFilterNoise = false;
         }
     }
+    else if (paramName == "temporalFiltering")
+    {
+        float weight, threshold;
+        if (!readParam(pParam, weight, 1) || !readParam(pParam, threshold, 2))
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Message wrongly formed for temporalFiltering", mClassName.c_str());
+            return;
+        }
+
+        lock_guard<mutex> lock(mCorrectionMutex);
+        if (weight <= 0.f || weight >= 1.f)
+        {
+            mFilterTemporal = false;
+        }
+        else
+        {
+            mFilterTemporal = true;
+            mTemporalWeight = weight;
+            mTemporalThreshold = max(0.f, min(255.f, threshold));
+        }
+        mTemporalAccumulator = cv::Mat();
+    }
     else if (paramName == "gammaCorrection")
     {
         float g;
@@ -363,7 +574,7 @@ void Source_2D::setBaseParameter(atom::Message pParam)
             return;
         }
 
-        vector< vector<float> > keys;
+        vector< vector<float> > keys(nbr / 2, vector<float>(2));
         for (int i = 0; i < nbr / 2; ++i)
         {
             if (!readParam(pParam, keys[i][0], i * 2 + 3))
@@ -413,6 +624,57 @@ void Source_2D::setBaseParameter(atom::Message pParam)
 
         mHdriActive = true;
     }
+    else if (paramName == "correctionOrder")
+    {
+        vector<string> names;
+        for (int i = 1; i < pParam.size(); ++i)
+        {
+            string name;
+            if (!readParam(pParam, name, i))
+            {
+                g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Message wrongly formed for correctionOrder", mClassName.c_str());
+                return;
+            }
+            names.push_back(name);
+        }
+
+        lock_guard<mutex> lock(mCorrectionMutex);
+        setCorrectionOrder(names);
+    }
+    else if (paramName == "correctionEnabled")
+    {
+        string name;
+        int enabled;
+        if (!readParam(pParam, name, 1) || !readParam(pParam, enabled, 2))
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Message wrongly formed for correctionEnabled", mClassName.c_str());
+            return;
+        }
+
+        lock_guard<mutex> lock(mCorrectionMutex);
+        for (auto& stage : mCorrectionStages)
+            if (stage.name == name)
+                stage.enabled = (enabled != 0);
+    }
+    else if (paramName == "tonemapping")
+    {
+        int active;
+        if (!readParam(pParam, active, 1))
+            return;
+
+        lock_guard<mutex> lock(mCorrectionMutex);
+        mTonemapping = (active != 0);
+
+        int op;
+        if (readParam(pParam, op, 2))
+            mTonemapper.setOperator(op == 1 ? Tonemapper::reinhard : Tonemapper::gamma);
+        float percentile;
+        if (readParam(pParam, percentile, 3))
+            mTonemapper.setPercentile(percentile);
+        float gamma;
+        if (readParam(pParam, gamma, 4))
+            mTonemapper.setGamma(gamma);
+    }
     else if (paramName == "save")
     {
         float active, period;
@@ -425,10 +687,17 @@ void Source_2D::setBaseParameter(atom::Message pParam)
         if (!readParam(pParam, filename, 3))
             return;
 
+        lock_guard<mutex> lock(mCorrectionMutex);
         if (active == 1.f)
         {
+            if (mFrameWriter.get() == NULL)
+            {
+                mFrameWriter.reset(new FrameWriter(mSaveThreads, mSaveQueueSize));
+                mFrameWriter->setFormat(mSaveExtension, mSaveCompression);
+                mFrameWriter->setDropPolicy((FrameWriter::DropPolicy)mSaveDropPolicy);
+            }
             mSaveToFile = true;
-            mSavePeriod = (int)period;
+            mSavePeriod = max(1, (int)period);
             mBaseFilename = filename;
         }
         else
@@ -436,6 +705,61 @@ void Source_2D::setBaseParameter(atom::Message pParam)
             mSaveToFile = false;
         }
     }
+    else if (paramName == "saveFormat")
+    {
+        string extension;
+        if (!readParam(pParam, extension, 1))
+            return;
+        int compression = -1;
+        readParam(pParam, compression, 2);
+
+        lock_guard<mutex> lock(mCorrectionMutex);
+        mSaveExtension = extension;
+        mSaveCompression = compression;
+        if (mFrameWriter.get() != NULL)
+            mFrameWriter->setFormat(mSaveExtension, mSaveCompression);
+    }
+    else if (paramName == "record")
+    {
+        string filename;
+        if (!readParam(pParam, filename))
+            return;
+
+        lock_guard<mutex> lock(mCorrectionMutex);
+        if (filename == "")
+            mRecorder.close();
+        else if (mRecorder.open(filename))
+            g_log(NULL, G_LOG_LEVEL_INFO, "%s - Recording raw frames to %s", mClassName.c_str(), filename.c_str());
+    }
+    else if (paramName == "saveQueue")
+    {
+        int threads, size;
+        if (!readParam(pParam, threads, 1) || !readParam(pParam, size, 2))
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Message wrongly formed for saveQueue", mClassName.c_str());
+            return;
+        }
+        int policy = FrameWriter::dropNewest;
+        readParam(pParam, policy, 3);
+
+        // A running writer is replaced. The old one is destroyed once the lock is released,
+        // as its destructor waits for its queued frames to be written
+        shared_ptr<FrameWriter> previousWriter;
+        {
+            lock_guard<mutex> lock(mCorrectionMutex);
+            mSaveThreads = max(1, threads);
+            mSaveQueueSize = max(1, size);
+            mSaveDropPolicy = policy == 0 ? FrameWriter::dropNewest : FrameWriter::dropOldest;
+            if (mFrameWriter.get() != NULL)
+            {
+                previousWriter = mFrameWriter;
+                mFrameWriter.reset(new FrameWriter(mSaveThreads, mSaveQueueSize));
+                mFrameWriter->setFormat(mSaveExtension, mSaveCompression);
+                mFrameWriter->setDropPolicy((FrameWriter::DropPolicy)mSaveDropPolicy);
+            }
+        }
+        previousWriter.reset();
+    }
 }
 
 /************/
@@ -459,6 +783,29 @@ atom::Message Source_2D::getBaseParameter(atom::Message pParam) const
     msg.push_back(pParam[0]);
     if (paramName == "id")
         msg.push_back(atom::StringValue::create(mId.c_str()));
+    else if (paramName == "saveDropped")
+    {
+        lock_guard<mutex> lock(mCorrectionMutex);
+        msg.push_back(atom::IntValue::create(mFrameWriter.get() == NULL ? 0 : (int)mFrameWriter->getDropped()));
+    }
+    else if (paramName == "recordedFrames")
+    {
+        lock_guard<mutex> lock(mCorrectionMutex);
+        msg.push_back(atom::IntValue::create((int)mRecorder.getFrames()));
+    }
+    else if (paramName == "correctionStages")
+    {
+        // For each stage, in order: name, enabled, active, mean duration in ms
+        lock_guard<mutex> lock(mCorrectionMutex);
+        for (auto& stage : mCorrectionStages)
+        {
+            msg.push_back(atom::StringValue::create(stage.name.c_str()));
+            msg.push_back(atom::IntValue::create((int)stage.enabled));
+            msg.push_back(atom::IntValue::create((int)stage.isActive()));
+            float duration = stage.calls == 0 ? 0.f : (float)stage.duration / (float)stage.calls / 1000.f;
+            msg.push_back(atom::FloatValue::create(duration));
+        }
+    }
 
     return msg;
 }
@@ -472,53 +819,53 @@ float Source_2D::getEV()
 /************/
 void Source_2D::applyMask(cv::Mat& pImg)
 {
-    // If not done yet, the mask is converted to float and resized accordingly to pImg
-    if (pImg.rows != mMask.rows || pImg.cols != mMask.cols)
-    {
-        cv::Mat buffer;
-        cv::resize(mMask, buffer, cv::Size(pImg.cols, pImg.rows), 0, 0, cv::INTER_NEAREST);
-        mMask = buffer;
-    }
-    if (mMask.type() != pImg.type())
-    {
-        cv::Mat buffer;
-        mMask.convertTo(buffer, pImg.type());
-        mMask = buffer;
-        
-        vector<cv::Mat> input;
-        for (int i = 0; i < pImg.channels(); ++i)
-            input.push_back(mMask);
-
-        cv::merge(input, buffer);
-        mMask = buffer;
-    }
-
-    cv::multiply(mMask, pImg, pImg);
+    // The mask is resized and expanded to the pixel size of pImg once,
+    // then applied with a single bitwise AND
+    mMask.apply(pImg);
 }
 
 /************/
-void Source_2D::filterNoise(cv::Mat& pImg)
+void Source_2D::filterNoise(const cv::Mat& pImg, cv::Mat& pOutput)
 {
     // We apply a simple median filter of size 1px to reduce noise
-    cv::medianBlur(pImg, pImg, 3);
+    cv::medianBlur(pImg, pOutput, 3);
 }
 
 /************/
-void Source_2D::scale(cv::Mat& pImg)
+void Source_2D::filterTemporal(cv::Mat& pImg)
 {
-    cv::Mat output;
-    cv::resize(pImg, output, cv::Size(), mScale, mScale, cv::INTER_LINEAR);
-    pImg = output;
+    if (pImg.depth() != CV_8U)
+    {
+        g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Temporal filtering is only available for 8 bits images, deactivating it", mClassName.c_str());
+        mFilterTemporal = false;
+        return;
+    }
+
+    // The average is reset whenever the frame format changes
+    if (mTemporalAccumulator.size() != pImg.size() || mTemporalAccumulator.channels() != pImg.channels())
+    {
+        pImg.convertTo(mTemporalAccumulator, CV_MAKE_TYPE(CV_16S, pImg.channels()), 1 << TEMPORAL_SHIFT);
+        return;
+    }
+
+    short weight = (short)max(1.f, min(32767.f, mTemporalWeight * 32768.f));
+    short threshold = (short)(mTemporalThreshold * (1 << TEMPORAL_SHIFT));
+    cv::parallel_for_(cv::Range(0, pImg.rows), Parallel_TemporalFilter(&pImg, &mTemporalAccumulator, weight, threshold));
 }
 
 /************/
-void Source_2D::rotate(cv::Mat& pImg)
+void Source_2D::scale(const cv::Mat& pImg, cv::Mat& pOutput)
+{
+    float factor = mScale / mRawScale;
+    cv::resize(pImg, pOutput, cv::Size(), factor, factor, cv::INTER_LINEAR);
+}
+
+/************/
+void Source_2D::rotate(const cv::Mat& pImg, cv::Mat& pOutput)
 {
     cv::Point2f center = cv::Point2f((float)pImg.cols / 2.f, (float)pImg.rows / 2.f);
     cv::Mat rotMat = cv::getRotationMatrix2D(center, mRotation, 1.0);
-    cv::Mat rotatedMat;
-    cv::warpAffine(pImg, rotatedMat, rotMat, cv::Size(pImg.cols, pImg.rows), cv::INTER_LINEAR);
-    pImg = rotatedMat;
+    cv::warpAffine(pImg, pOutput, rotMat, cv::Size(pImg.cols, pImg.rows), cv::INTER_LINEAR);
 }
 
 /*************/
@@ -536,17 +883,17 @@ void Source_2D::correctVignetting(cv::Mat& pImg)
         // Vignetting description has changed, or grabbed image has not the same resolution
         int nbrChannels = (pImg.type() >> CV_CN_SHIFT) + 1;
         int type = CV_MAKE_TYPE(CV_32F, nbrChannels);
-        mVignettingMat = cv::Mat::zeros(mHeight, mWidth, type);
+        mVignettingMat = cv::Mat::zeros(pImg.rows, pImg.cols, type);
 
         cv::Point2f center;
-        center.x = (float)mWidth / 2.f;
-        center.y = (float)mHeight / 2.f;
+        center.x = (float)pImg.cols / 2.f;
+        center.y = (float)pImg.rows / 2.f;
         
         float sqfactor = pow(center.y, 2.f) + pow(center.x, 2.f);
 
-        for (int x = 0; x < (int)mWidth; ++x)
+        for (int x = 0; x < pImg.cols; ++x)
         {
-            for (int y = 0; y < (int)mHeight; ++y)
+            for (int y = 0; y < pImg.rows; ++y)
             {
                 float sqradius = (pow((float)x-center.x, 2.f) + pow((float)y-center.y, 2.f))/sqfactor;
                 float correction = 1.f / (1.f + mOpticalDesc.vignetting[0] * sqradius
@@ -582,12 +929,12 @@ void Source_2D::correctGamma(cv::Mat& pImg)
 }
 
 /************/
-void Source_2D::correctDistortion(cv::Mat& pImg)
+void Source_2D::correctDistortion(const cv::Mat& pImg, cv::Mat& pOutput)
 {
     if (mRecomputeDistortionMat == true || mDistortionMat.size() != pImg.size())
     {
         // Distortion description has changed, or grabbed image has not the same resolution
-        mDistortionMat = cv::Mat::zeros(mHeight, mWidth, CV_32FC2);
+        mDistortionMat = cv::Mat::zeros(pImg.rows, pImg.cols, CV_32FC2);
 
         float a, b, c;
         a = mOpticalDesc.distortion[0];
@@ -595,14 +942,14 @@ void Source_2D::correctDistortion(cv::Mat& pImg)
         c = mOpticalDesc.distortion[2];
 
         cv::Point2f center;
-        center.x = (float)mWidth / 2.f;
-        center.y = (float)mHeight / 2.f;
+        center.x = (float)pImg.cols / 2.f;
+        center.y = (float)pImg.rows / 2.f;
 
         float radius = std::min(center.x, center.y);
         
-        for (int x = 0; x < (int)mWidth; ++x)
+        for (int x = 0; x < pImg.cols; ++x)
         {
-            for (int y = 0; y < (int)mHeight; ++y)
+            for (int y = 0; y < pImg.rows; ++y)
             {
                 // Compute the distance to center in normalized value
                 // See http://wiki.panotools.org/Lens_correction_model for information
@@ -624,31 +971,29 @@ void Source_2D::correctDistortion(cv::Mat& pImg)
         mRecomputeDistortionMat = false;
     }
 
-    cv::Mat resultMat;
-    cv::remap(pImg, resultMat, mDistortionMat, cv::Mat(), cv::INTER_LINEAR);
-
-    pImg = resultMat;
+    cv::remap(pImg, pOutput, mDistortionMat, cv::Mat(), cv::INTER_LINEAR);
 }
 
 /************/
-void Source_2D::correctFisheye(cv::Mat& pImg)
+void Source_2D::correctFisheye(const cv::Mat& pImg, cv::Mat& pOutput)
 {
     if (mRecomputeFisheyeMat == true || mFisheyeMat.size() != pImg.size())
     {
-        mFisheyeMat = cv::Mat::zeros(mHeight, mWidth, CV_32FC2);
-        float inFocal = mOpticalDesc.fisheye[0];
-        float outFocal = mOpticalDesc.fisheye[1];
+        mFisheyeMat = cv::Mat::zeros(pImg.rows, pImg.cols, CV_32FC2);
+        // Focals are given in pixels of the full resolution frames
+        float inFocal = mOpticalDesc.fisheye[0] * mRawScale;
+        float outFocal = mOpticalDesc.fisheye[1] * mRawScale;
 
         cv::Point2f center;
-        center.x = (float)mWidth / 2.f;
-        center.y = (float)mHeight / 2.f;
+        center.x = (float)pImg.cols / 2.f;
+        center.y = (float)pImg.rows / 2.f;
 
         // See http://wiki.panotools.org/Fisheye_Projection for more information
         float radius = std::min(center.x, center.y);
 
-        for (int x = 0; x < (int)mWidth; ++x)
+        for (int x = 0; x < pImg.cols; ++x)
         {
-            for (int y = 0; y < (int)mHeight; ++y)
+            for (int y = 0; y < pImg.rows; ++y)
             {
                 float dstRadius = sqrtf(pow((float)x - center.x, 2.f) + pow((float)y - center.y, 2.f));
                 cv::Vec2f dir;
@@ -666,10 +1011,7 @@ void Source_2D::correctFisheye(cv::Mat& pImg)
         mRecomputeFisheyeMat = false;
     }
 
-    cv::Mat resultMat;
-    cv::remap(pImg, resultMat, mFisheyeMat, cv::Mat(), cv::INTER_LINEAR);
-
-    pImg = resultMat;
+    cv::remap(pImg, pOutput, mFisheyeMat, cv::Mat(), cv::INTER_LINEAR);
 }
 
 /************/
@@ -823,11 +1165,9 @@ void Source_2D::saveToFile(cv::Mat& pImg)
         char buffer[16];
         sprintf(buffer, "%05i", mSaveIndex);
         string filename = mBaseFilename + string(buffer);
-        if (pImg.depth() == CV_8U || pImg.depth() == CV_16U)
-        {
-            filename += string(".png");
-            cv::imwrite(filename, pImg);
-        }
+        // Encoding is done by the writer threads, frames being dropped if they can't keep up
+        if ((pImg.depth() == CV_8U || pImg.depth() == CV_16U) && mFrameWriter.get() != NULL)
+            mFrameWriter->write(pImg, filename);
 
         mSaveIndex++;
         mSavePhase++;
@@ -4,13 +4,15 @@
 
 using namespace std;
 
+#define GIGE_POOL_SIZE 8
+
 string Source_2D_Gige::mClassName = "Source_2D_Gige";
 string Source_2D_Gige::mDocumentation = "N/A";
 
 /*************/
 Source_2D_Gige::Source_2D_Gige()
 {
-    make(0);
+    make(string());
 }
 
 /*************/
@@ -29,6 +31,7 @@ void Source_2D_Gige::make(string pParam)
     mStream = NULL;
 
     mInvertRGB = false;
+    mBayer = false;
 
     mConvertedFrame = cv::Mat::zeros(480, 640, CV_8UC3);
 
@@ -119,46 +122,46 @@ bool Source_2D_Gige::grabFrame()
 {
     // If in-camera autoexposure is on, this needs to be done at each frame
     mExposureTime = arv_camera_get_exposure_time(mCamera) / 1e6;
-    
-    cv::Mat img = mBuffer.get().clone();
-    if (mInvertRGB && mChannels == 3)
-    {
-        cv::Mat inverted = cv::Mat::zeros(img.size(), img.type());
-        cv::cvtColor(img, inverted, CV_BGR2RGB);
-        img = inverted;
-    }
-    else if (mBayer && mChannels == 1)
-    {
-        cv::Mat bayer = cv::Mat::zeros(img.size(), CV_8UC3);
-        switch (arv_camera_get_pixel_format(mCamera))
-        {
-        case ARV_PIXEL_FORMAT_BAYER_BG_8:
-            cvtColor(img, bayer, CV_BayerBG2RGB);
-            break;
-        case ARV_PIXEL_FORMAT_BAYER_GB_8:
-            cvtColor(img, bayer, CV_BayerGB2RGB);
-            break;
-        case ARV_PIXEL_FORMAT_BAYER_RG_8:
-            cvtColor(img, bayer, CV_BayerRG2RGB);
-            break;
-        case ARV_PIXEL_FORMAT_BAYER_GR_8:
-            cvtColor(img, bayer, CV_BayerGR2RGB);
-            break;
-        }
-        img = bayer;
-    }
 
-    {
-        lock_guard<mutex> lock(mFrameMutex);
-        mConvertedFrame = img;
-    }
+    // Frames are converted as they arrive, in the stream callback
+    return true;
 }
 
 /*************/
 cv::Mat Source_2D_Gige::retrieveRawFrame()
 {
+    // The frame is not reused by the stream callback while it is held here
     lock_guard<mutex> lock(mFrameMutex);
-    return mConvertedFrame.clone();
+    return mConvertedFrame;
+}
+
+/*************/
+cv::Mat Source_2D_Gige::getPooledFrame(int pRows, int pCols, int pType)
+{
+    // A frame only referenced by the pool is not used anywhere else, and can be overwritten
+    for (auto& frame : mFramePool)
+        if (frame.refcount != NULL && *frame.refcount == 1 && frame.rows == pRows && frame.cols == pCols && frame.type() == pType)
+            return frame;
+
+    cv::Mat frame(pRows, pCols, pType);
+    if (mFramePool.size() < GIGE_POOL_SIZE)
+    {
+        mFramePool.push_back(frame);
+    }
+    else
+    {
+        // Frames with another size or type are replaced first
+        for (auto& pooled : mFramePool)
+        {
+            if (pooled.refcount != NULL && *pooled.refcount == 1)
+            {
+                pooled = frame;
+                break;
+            }
+        }
+    }
+
+    return frame;
 }
 
 /*************/
@@ -421,14 +424,55 @@ void Source_2D_Gige::streamCb(void* user_data, ArvStreamCallbackType type, ArvBu
     {
         if (buffer->status == ARV_BUFFER_STATUS_SUCCESS)
         {
+            // The Aravis buffer is converted directly into a pooled frame
+            int bpp = ARV_PIXEL_FORMAT_BIT_PER_PIXEL(buffer->pixel_format);
+            cv::Mat raw(buffer->height, buffer->width, bpp == 8 ? CV_8U : CV_8UC3, buffer->data);
+
+            int bayerCode = -1;
+            if (source->mBayer && bpp == 8)
+            {
+                switch (buffer->pixel_format)
+                {
+                case ARV_PIXEL_FORMAT_BAYER_BG_8:
+                    bayerCode = CV_BayerBG2RGB;
+                    break;
+                case ARV_PIXEL_FORMAT_BAYER_GB_8:
+                    bayerCode = CV_BayerGB2RGB;
+                    break;
+                case ARV_PIXEL_FORMAT_BAYER_RG_8:
+                    bayerCode = CV_BayerRG2RGB;
+                    break;
+                case ARV_PIXEL_FORMAT_BAYER_GR_8:
+                    bayerCode = CV_BayerGR2RGB;
+                    break;
+                }
+            }
+
             cv::Mat img;
-            if (source->mChannels == 3)
-                img = cv::Mat::zeros(source->mHeight, source->mWidth, CV_8UC3);
+            if (bayerCode != -1)
+            {
+                img = source->getPooledFrame(raw.rows, raw.cols, CV_8UC3);
+                cv::cvtColor(raw, img, bayerCode);
+            }
+            else if (source->mInvertRGB && bpp != 8)
+            {
+                img = source->getPooledFrame(raw.rows, raw.cols, raw.type());
+                cv::cvtColor(raw, img, CV_BGR2RGB);
+            }
             else
-                img = cv::Mat::zeros(source->mHeight, source->mWidth, CV_8U);
+            {
+                img = source->getPooledFrame(raw.rows, raw.cols, raw.type());
+                raw.copyTo(img);
+            }
+
+            // The buffer is given back to the stream as soon as possible
+            arv_stream_push_buffer(source->mStream, buffer);
+            buffer = NULL;
 
-            memcpy(img.data, buffer->data, buffer->width * buffer->height * ARV_PIXEL_FORMAT_BIT_PER_PIXEL(buffer->pixel_format) / 8);
-            source->mBuffer = img;
+            {
+                lock_guard<mutex> lock(source->mFrameMutex);
+                source->mConvertedFrame = img;
+            }
             source->mUpdated = true;
         }
         else
@@ -460,7 +504,9 @@ void Source_2D_Gige::streamCb(void* user_data, ArvStreamCallbackType type, ArvBu
             }
             g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - Error in the received packet: %s", source->mClassName.c_str(), msg.c_str());
         }
-        arv_stream_push_buffer(source->mStream, buffer);
+
+        if (buffer != NULL)
+            arv_stream_push_buffer(source->mStream, buffer);
     }
     else
     {
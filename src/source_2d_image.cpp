@@ -1,14 +1,46 @@
 #include "source_2d_image.h"
 
+#include <algorithm>
+#include <cctype>
+#include <dirent.h>
+#include <glob.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace std;
 
 string Source_2D_Image::mClassName = "Source_2D_Image";
 string Source_2D_Image::mDocumentation = "N/A";
 
+/*************/
+// Checks that a url is a numbered sequence pattern, i.e. that it contains exactly
+// one integer conversion (%d, %Nd or %0Nd), other percent signs being escaped as %%
+static bool isSequencePattern(const string& pUrl)
+{
+    int conversions = 0;
+    for (size_t i = 0; i < pUrl.size(); ++i)
+    {
+        if (pUrl[i] != '%')
+            continue;
+
+        i++;
+        if (i < pUrl.size() && pUrl[i] == '%')
+            continue;
+
+        while (i < pUrl.size() && isdigit(pUrl[i]))
+            i++;
+        if (i >= pUrl.size() || pUrl[i] != 'd')
+            return false;
+        conversions++;
+    }
+
+    return conversions == 1;
+}
+
 /*************/
 Source_2D_Image::Source_2D_Image()
 {
-    make(0);
+    make(string());
 }
 
 /*************/
@@ -22,6 +54,14 @@ void Source_2D_Image::make(string pParam)
 {
     mName = mClassName;
     mSubsourceNbr = pParam;
+
+    mStopDecoders = false;
+    mDecoderNbr = 2;
+    mCacheSize = 8;
+    mLoop = true;
+    mPosition = -1;
+    mCurrentScale = 1.f;
+    mLastFrameTime = chrono::high_resolution_clock::now();
 }
 
 /*************/
@@ -47,20 +87,269 @@ bool Source_2D_Image::connect()
 /*************/
 bool Source_2D_Image::disconnect()
 {
+    stopDecoders();
     return true;
 }
 
 /*************/
 bool Source_2D_Image::grabFrame()
 {
-    mUpdated = true;
+    if (mFiles.size() == 0)
+    {
+        mUpdated = true;
+        return true;
+    }
+
+    // With no framerate set, each frame is output once the previous one has been processed
+    if (mFramerate == 0)
+    {
+        if (mUpdated)
+            return true;
+    }
+    else if (chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - mLastFrameTime).count() < 1e6 / mFramerate)
+    {
+        return true;
+    }
+
+    {
+        lock_guard<mutex> lock(mCacheMutex);
+
+        long long next = getNextIndex(0);
+        if (next < 0)
+            return true;
+
+        // Nothing is output until the next frame has been decoded
+        auto frameIt = mCache.find(next);
+        if (frameIt == mCache.end())
+            return true;
+
+        DecodedFrame frame = frameIt->second;
+        mCache.erase(frameIt);
+        mPosition = next;
+
+        // Frames are consumed in order, so only those ahead are kept
+        set<size_t> ahead;
+        for (unsigned int i = 0; i < mCacheSize; ++i)
+        {
+            long long index = getNextIndex(i);
+            if (index >= 0)
+                ahead.insert(index);
+        }
+        for (auto it = mCache.begin(); it != mCache.end();)
+        {
+            if (ahead.find(it->first) == ahead.end())
+                it = mCache.erase(it);
+            else
+                ++it;
+        }
+
+        // Unreadable files are skipped
+        if (frame.image.total() != 0)
+        {
+            lock_guard<mutex> lockBuffer(mMutex);
+            mCurrentFrame = frame.image;
+            mCurrentScale = frame.scale;
+            mWidth = frame.size.width;
+            mHeight = frame.size.height;
+            mChannels = frame.image.channels();
+            mUpdated = true;
+        }
+    }
+    mCacheCondition.notify_all();
+    mLastFrameTime = chrono::high_resolution_clock::now();
+
     return true;
 }
 
 /*************/
 cv::Mat Source_2D_Image::retrieveRawFrame()
 {
-    return mImage.clone();
+    // A single image is always loaded at full resolution
+    if (mFiles.size() == 0)
+    {
+        mRawScale = 1.f;
+        return mImage.clone();
+    }
+
+    // Decoded frames are output only once, so they need no copy
+    lock_guard<mutex> lock(mMutex);
+    mRawScale = mCurrentScale;
+    return mCurrentFrame;
+}
+
+/*************/
+long long Source_2D_Image::getNextIndex(unsigned int pOffset) const
+{
+    if (mFiles.size() == 0)
+        return -1;
+
+    long long index = mPosition + 1 + pOffset;
+    if (index >= (long long)mFiles.size())
+    {
+        if (!mLoop)
+            return -1;
+        index %= mFiles.size();
+    }
+
+    return index;
+}
+
+/*************/
+bool Source_2D_Image::listFiles(const string& pUrl)
+{
+    static const set<string> extensions = {"bmp", "dib", "jpeg", "jpg", "jpe", "jp2", "png", "pbm", "pgm", "ppm", "sr", "ras", "tiff", "tif", "exr", "hdr", "pic"};
+
+    mFiles.clear();
+
+    struct stat fileStat;
+    if (stat(pUrl.c_str(), &fileStat) == 0 && S_ISDIR(fileStat.st_mode))
+    {
+        DIR* directory = opendir(pUrl.c_str());
+        if (directory == NULL)
+            return true;
+
+        struct dirent* entry;
+        while ((entry = readdir(directory)) != NULL)
+        {
+            string name(entry->d_name);
+            size_t dot = name.find_last_of('.');
+            if (dot == string::npos)
+                continue;
+
+            string extension = name.substr(dot + 1);
+            transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+            if (extensions.find(extension) != extensions.end())
+                mFiles.push_back(pUrl + "/" + name);
+        }
+        closedir(directory);
+
+        sort(mFiles.begin(), mFiles.end());
+    }
+    else if (isSequencePattern(pUrl))
+    {
+        // Numbered sequence, starting at 0 or 1 and ending at the first missing file
+        char filename[1024];
+        for (int i = 0; ; ++i)
+        {
+            snprintf(filename, 1024, pUrl.c_str(), i);
+            if (access(filename, R_OK) == 0)
+                mFiles.push_back(string(filename));
+            else if (i > 0 || mFiles.size() != 0)
+                break;
+        }
+    }
+    else if (pUrl.find_first_of("*?[") != string::npos)
+    {
+        glob_t files;
+        if (glob(pUrl.c_str(), 0, NULL, &files) == 0)
+        {
+            for (size_t i = 0; i < files.gl_pathc; ++i)
+                mFiles.push_back(string(files.gl_pathv[i]));
+        }
+        globfree(&files);
+    }
+    else
+    {
+        return false;
+    }
+
+    return true;
+}
+
+/*************/
+void Source_2D_Image::startDecoders()
+{
+    for (unsigned int i = 0; i < mDecoderNbr; ++i)
+        mDecoders.push_back(thread(&Source_2D_Image::decode, this));
+}
+
+/*************/
+void Source_2D_Image::stopDecoders()
+{
+    {
+        lock_guard<mutex> lock(mCacheMutex);
+        mStopDecoders = true;
+    }
+    mCacheCondition.notify_all();
+
+    for (auto& decoder : mDecoders)
+        decoder.join();
+    mDecoders.clear();
+
+    lock_guard<mutex> lock(mCacheMutex);
+    mStopDecoders = false;
+    mCache.clear();
+    mPending.clear();
+}
+
+/*************/
+void Source_2D_Image::decode()
+{
+    while (true)
+    {
+        size_t index;
+        string filename;
+        {
+            unique_lock<mutex> lock(mCacheMutex);
+
+            // Decodes the closest frame ahead which is neither decoded nor being decoded
+            long long next = -1;
+            while (!mStopDecoders)
+            {
+                for (unsigned int i = 0; i < mCacheSize && next < 0; ++i)
+                {
+                    long long candidate = getNextIndex(i);
+                    if (candidate < 0)
+                        break;
+                    if (mCache.find(candidate) == mCache.end() && mPending.find(candidate) == mPending.end())
+                        next = candidate;
+                }
+
+                if (next >= 0)
+                    break;
+                mCacheCondition.wait(lock);
+            }
+
+            if (mStopDecoders)
+                return;
+
+            index = next;
+            filename = mFiles[index];
+            mPending.insert(index);
+        }
+
+        // When the frames are to be scaled down, it is done here rather than in the correction thread
+        DecodedFrame frame;
+        frame.scale = min(1.f, getScale());
+        frame.image = cv::imread(filename);
+        frame.size = frame.image.size();
+        if (frame.image.total() == 0)
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Unable to load image from path %s", mClassName.c_str(), filename.c_str());
+        }
+        else if (frame.scale < 1.f)
+        {
+            cv::Mat reduced;
+            cv::resize(frame.image, reduced, cv::Size(), frame.scale, frame.scale, cv::INTER_AREA);
+            frame.image = reduced;
+        }
+
+        {
+            lock_guard<mutex> lock(mCacheMutex);
+            mPending.erase(index);
+
+            // The frame may not be needed anymore, if the position changed meanwhile
+            for (unsigned int i = 0; i < mCacheSize; ++i)
+            {
+                if (getNextIndex(i) == (long long)index)
+                {
+                    mCache[index] = frame;
+                    break;
+                }
+            }
+        }
+        mCacheCondition.notify_all();
+    }
 }
 
 /*************/
@@ -84,11 +373,29 @@ void Source_2D_Image::setParameter(atom::Message pParam)
         if (!readParam(pParam, url))
             return;
 
+        stopDecoders();
+
+        if (listFiles(url))
+        {
+            if (mFiles.size() == 0)
+            {
+                g_log(NULL, G_LOG_LEVEL_WARNING, "%s - No image found from path %s", mClassName.c_str(), url.c_str());
+                return;
+            }
+
+            g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - Found %lu images from path %s", mClassName.c_str(), (unsigned long)mFiles.size(), url.c_str());
+            mImage = cv::Mat();
+            mPosition = -1;
+            startDecoders();
+            return;
+        }
+
         cv::Mat img = cv::imread(url);
-        if (img.total() > 0, -1)
+        if (img.total() > 0)
         {
             g_log(NULL, G_LOG_LEVEL_DEBUG, "%s - Successfully loaded image from path %s", mClassName.c_str(), url.c_str());
             mImage = img;
+            mRawScale = 1.f;
             mWidth = img.cols;
             mHeight = img.rows;
             mChannels = img.channels();
@@ -98,6 +405,40 @@ void Source_2D_Image::setParameter(atom::Message pParam)
             g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Unable to load image from path %s", mClassName.c_str(), url.c_str());
         }
     }
+    else if (paramName == "readAhead")
+    {
+        int threads, size;
+        if (!readParam(pParam, threads, 1) || !readParam(pParam, size, 2))
+        {
+            g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Message wrongly formed for readAhead", mClassName.c_str());
+            return;
+        }
+
+        bool running = mDecoders.size() != 0;
+        stopDecoders();
+        mDecoderNbr = max(1, threads);
+        mCacheSize = max(1, size);
+        if (running)
+            startDecoders();
+    }
+    else if (paramName == "loop")
+    {
+        int loop;
+        if (!readParam(pParam, loop))
+            return;
+
+        {
+            lock_guard<mutex> lock(mCacheMutex);
+            mLoop = (loop != 0);
+        }
+        mCacheCondition.notify_all();
+    }
+    else if (paramName == "framerate")
+    {
+        int framerate;
+        if (readParam(pParam, framerate))
+            mFramerate = max(0, framerate);
+    }
     else
         setBaseParameter(pParam);
 }
@@ -1,5 +1,7 @@
 #include "source_2d_opencv.h"
 
+#include <chrono>
+
 using namespace std;
 
 string Source_2D_OpenCV::mClassName = "Source_2D_OpenCV";
@@ -8,7 +10,7 @@ string Source_2D_OpenCV::mDocumentation = "N/A";
 /*************/
 Source_2D_OpenCV::Source_2D_OpenCV()
 {
-    make(0);
+    make(string());
 }
 
 /*************/
@@ -24,6 +26,11 @@ void Source_2D_OpenCV::make(string pParam)
     mSubsourceNbr = pParam;
 
     mVideoUrl = string("");
+
+    mIsDecoding = false;
+    mQueueSize = 4;
+    mPlayback = realTime;
+    mDropped = 0;
 }
 
 /*************/
@@ -64,6 +71,9 @@ bool Source_2D_OpenCV::connect()
 /*************/
 bool Source_2D_OpenCV::disconnect()
 {
+    stopDecoding();
+
+    lock_guard<mutex> lock(mCaptureMutex);
     mCamera.release();
     return true;
 }
@@ -71,6 +81,37 @@ bool Source_2D_OpenCV::disconnect()
 /*************/
 bool Source_2D_OpenCV::grabFrame()
 {
+    if (mDecodeThread.get() != NULL)
+    {
+        cv::Mat frame;
+        {
+            lock_guard<mutex> lock(mQueueMutex);
+            if (mQueue.size() == 0)
+                return true;
+
+            if (mPlayback == lossless)
+            {
+                // The previous frame has to be processed first
+                if (mUpdated)
+                    return true;
+                frame = mQueue.front();
+                mQueue.pop_front();
+            }
+            else
+            {
+                frame = mQueue.back();
+                mDropped += mQueue.size() - 1;
+                mQueue.clear();
+            }
+        }
+        mQueueCondition.notify_all();
+
+        lock_guard<mutex> lock(mMutex);
+        mBuffer = frame;
+        mUpdated = true;
+        return true;
+    }
+
     if (!mCamera.isOpened())
         return false;
 
@@ -82,6 +123,13 @@ bool Source_2D_OpenCV::grabFrame()
 /*************/
 cv::Mat Source_2D_OpenCV::retrieveRawFrame()
 {
+    // Decoded frames are already copies, output once
+    if (mDecodeThread.get() != NULL)
+    {
+        lock_guard<mutex> lock(mMutex);
+        return mBuffer.get();
+    }
+
     cv::Mat buffer;
     mCamera.retrieve(buffer);
     mBuffer = buffer;
@@ -114,12 +162,52 @@ void Source_2D_OpenCV::setParameter(atom::Message pParam)
             return;
         mVideoUrl = url;
 
-        if (mCamera.isOpened())
+        // A camera device is not replaced by a file
+        if (mCamera.isOpened() && mDecodeThread.get() == NULL)
+            return;
+
+        stopDecoding();
+        {
+            lock_guard<mutex> lock(mCaptureMutex);
+            if (!mCamera.open(url))
+            {
+                g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Unable to open %s", mClassName.c_str(), url.c_str());
+                return;
+            }
+
+            mWidth = (unsigned int)(mCamera.get(CV_CAP_PROP_FRAME_WIDTH));
+            mHeight = (unsigned int)(mCamera.get(CV_CAP_PROP_FRAME_HEIGHT));
+            mFramerate = (unsigned int)(mCamera.get(CV_CAP_PROP_FPS));
+        }
+        startDecoding();
+        return;
+    }
+    else if (paramName == "playback")
+    {
+        int playback;
+        if (!readParam(pParam, playback))
             return;
-        mCamera.open(url);
+        mPlayback = playback == 0 ? realTime : lossless;
+        mQueueCondition.notify_all();
+        return;
     }
+    else if (paramName == "queueSize")
+    {
+        int size;
+        if (!readParam(pParam, size))
+            return;
+        {
+            lock_guard<mutex> lock(mQueueMutex);
+            mQueueSize = max(1, size);
+        }
+        mQueueCondition.notify_all();
+        return;
+    }
+
+    lock_guard<mutex> lockCapture(mCaptureMutex);
+
     // Next parameters are all numbers
-    else if (!readParam(pParam, paramValue))
+    if (!readParam(pParam, paramValue))
     {
         setBaseParameter(pParam);
         return;
@@ -210,6 +298,107 @@ void Source_2D_OpenCV::setParameter(atom::Message pParam)
     }
 }
 
+/*************/
+void Source_2D_OpenCV::startDecoding()
+{
+    mDropped = 0;
+    mIsDecoding = true;
+    mDecodeThread.reset(new thread(&Source_2D_OpenCV::decode, this));
+}
+
+/*************/
+void Source_2D_OpenCV::stopDecoding()
+{
+    if (mDecodeThread.get() == NULL)
+        return;
+
+    {
+        lock_guard<mutex> lock(mQueueMutex);
+        mIsDecoding = false;
+    }
+    mQueueCondition.notify_all();
+
+    mDecodeThread->join();
+    mDecodeThread.reset();
+
+    lock_guard<mutex> lock(mQueueMutex);
+    mQueue.clear();
+}
+
+/*************/
+void Source_2D_OpenCV::decode()
+{
+    timespec nap;
+    nap.tv_sec = 0;
+    nap.tv_nsec = 1e7;
+
+    bool started = false;
+    double firstPosition = 0.0;
+    chrono::high_resolution_clock::time_point start;
+
+    while (mIsDecoding)
+    {
+        // In lossless mode, decoding waits for room in the queue
+        {
+            unique_lock<mutex> lock(mQueueMutex);
+            while (mIsDecoding && mPlayback == lossless && mQueue.size() >= mQueueSize)
+                mQueueCondition.wait(lock);
+        }
+        if (!mIsDecoding)
+            break;
+
+        cv::Mat frame;
+        bool result;
+        double position;
+        {
+            lock_guard<mutex> lock(mCaptureMutex);
+            result = mCamera.read(frame);
+            position = mCamera.get(CV_CAP_PROP_POS_MSEC);
+        }
+
+        // End of file, or stream interrupted. Reading is retried until decoding is stopped,
+        // as a stream may come back and a file being written may grow
+        if (!result || frame.total() == 0)
+        {
+            nanosleep(&nap, NULL);
+            continue;
+        }
+
+        // The capture reuses its buffer for the next frame
+        frame = frame.clone();
+
+        // In real time, files are decoded at their own pace. Streams have no meaningful position, and are not paced
+        if (mPlayback == realTime && position > 0.0)
+        {
+            if (!started)
+            {
+                start = chrono::high_resolution_clock::now();
+                firstPosition = position;
+                started = true;
+            }
+
+            // The wait is split in short sleeps, so that stopping the decoding is not delayed by long frame gaps
+            chrono::high_resolution_clock::time_point due = start + chrono::microseconds((long long)((position - firstPosition) * 1000.0));
+            while (mIsDecoding && chrono::high_resolution_clock::now() < due)
+                this_thread::sleep_until(min(due, chrono::high_resolution_clock::now() + chrono::milliseconds(100)));
+        }
+        else
+        {
+            started = false;
+        }
+
+        {
+            lock_guard<mutex> lock(mQueueMutex);
+            if (mQueue.size() >= mQueueSize)
+            {
+                mQueue.pop_front();
+                mDropped++;
+            }
+            mQueue.push_back(frame);
+        }
+    }
+}
+
 /*************/
 atom::Message Source_2D_OpenCV::getParameter(atom::Message pParam) const
 {
@@ -237,6 +426,8 @@ atom::Message Source_2D_OpenCV::getParameter(atom::Message pParam) const
         msg.push_back(atom::IntValue::create(mFramerate));
     else if (paramName == "exposureTime")
         msg.push_back(atom::FloatValue::create(mExposureTime));
+    else if (paramName == "dropped")
+        msg.push_back(atom::IntValue::create((int)mDropped));
     else if (paramName == "subsourcenbr")
         msg.push_back(atom::StringValue::create(mSubsourceNbr.c_str()));
     else
@@ -0,0 +1,297 @@
+#include "source_2d_recording.h"
+
+#include <chrono>
+
+using namespace std;
+
+string Source_2D_Recording::mClassName = "Source_2D_Recording";
+string Source_2D_Recording::mDocumentation = "N/A";
+
+/*************/
+Source_2D_Recording::Source_2D_Recording()
+{
+    make(string());
+}
+
+/*************/
+Source_2D_Recording::Source_2D_Recording(string pParam)
+{
+    make(pParam);
+}
+
+/*************/
+void Source_2D_Recording::make(string pParam)
+{
+    mName = mClassName;
+    mSubsourceNbr = pParam;
+    mId = pParam;
+
+    mIsPlaying = false;
+    mPlayback = originalCadence;
+    mLoop = true;
+    mPlaybackRate = 30.f;
+    mPosition = 0;
+    mRestart = true;
+}
+
+/*************/
+Source_2D_Recording::~Source_2D_Recording()
+{
+    disconnect();
+}
+
+/*************/
+bool Source_2D_Recording::connect()
+{
+    return true;
+}
+
+/*************/
+bool Source_2D_Recording::disconnect()
+{
+    stop();
+
+    lock_guard<mutex> lock(mMutex);
+    mReader.close();
+
+    return true;
+}
+
+/*************/
+bool Source_2D_Recording::grabFrame()
+{
+    return true;
+}
+
+/*************/
+cv::Mat Source_2D_Recording::retrieveRawFrame()
+{
+    lock_guard<mutex> lock(mMutex);
+    return mBuffer.get();
+}
+
+/*************/
+void Source_2D_Recording::stop()
+{
+    mIsPlaying = false;
+    if (mPlaybackThread.get() != NULL)
+    {
+        mPlaybackThread->join();
+        mPlaybackThread.reset();
+    }
+}
+
+/*************/
+void Source_2D_Recording::play()
+{
+    timespec nap;
+    nap.tv_sec = 0;
+    nap.tv_nsec = 1e5;
+
+    chrono::high_resolution_clock::time_point start;
+    unsigned long long firstTimestamp = 0;
+    size_t firstIndex = 0;
+
+    while (mIsPlaying)
+    {
+        size_t index = mPosition;
+        unsigned long long timestamp;
+        {
+            lock_guard<mutex> lock(mMutex);
+            if (index >= mReader.size())
+            {
+                if (!mLoop || mReader.size() == 0)
+                {
+                    nanosleep(&nap, NULL);
+                    continue;
+                }
+                index = 0;
+                mPosition = 0;
+                mRestart = true;
+            }
+            timestamp = mReader.getTimestamp(index);
+        }
+
+        // Pacing is relative to the first frame output since the last (re)start
+        if (mRestart)
+        {
+            start = chrono::high_resolution_clock::now();
+            firstTimestamp = timestamp;
+            firstIndex = index;
+            mRestart = false;
+        }
+
+        if (mPlayback == asFastAsPossible)
+        {
+            // The previous frame has to be taken by the correction thread first
+            if (mUpdated)
+            {
+                nanosleep(&nap, NULL);
+                continue;
+            }
+        }
+        else
+        {
+            unsigned long long due;
+            if (mPlayback == originalCadence)
+                due = timestamp > firstTimestamp ? timestamp - firstTimestamp : 0;
+            else
+                due = (unsigned long long)((double)(index - firstIndex) * 1e6 / max(0.001f, mPlaybackRate));
+
+            unsigned long long elapsed = chrono::duration_cast<chrono::microseconds>(chrono::high_resolution_clock::now() - start).count();
+            if (elapsed < due)
+            {
+                // Short naps keep the thread responsive to parameter changes
+                timespec wait;
+                wait.tv_sec = 0;
+                wait.tv_nsec = min(due - elapsed, 10000ull) * 1000;
+                nanosleep(&wait, NULL);
+                continue;
+            }
+        }
+
+        {
+            lock_guard<mutex> lock(mMutex);
+            // The mapped frame is read-only, and is copied so that corrections can work in place
+            cv::Mat frame = mReader.getFrame(index).clone();
+            if (frame.total() != 0)
+            {
+                mBuffer = frame;
+                mWidth = frame.cols;
+                mHeight = frame.rows;
+                mChannels = frame.channels();
+                mUpdated = true;
+            }
+        }
+
+        // The position may have been changed meanwhile
+        unsigned long long expected = index;
+        mPosition.compare_exchange_strong(expected, index + 1);
+    }
+}
+
+/*************/
+void Source_2D_Recording::setParameter(atom::Message pParam)
+{
+    string paramName;
+
+    try
+    {
+        paramName = atom::toString(pParam[0]);
+    }
+    catch (atom::BadTypeTagError exception)
+    {
+        return;
+    }
+
+    if (paramName == "location")
+    {
+        string location;
+        if (!readParam(pParam, location))
+            return;
+
+        stop();
+
+        {
+            lock_guard<mutex> lock(mMutex);
+            if (!mReader.open(location))
+                return;
+            mPosition = 0;
+            mRestart = true;
+
+            // Source characteristics are known before the first frame is output
+            cv::Mat frame = mReader.getFrame(0);
+            mWidth = frame.cols;
+            mHeight = frame.rows;
+            mChannels = frame.channels();
+            if (mReader.size() > 1 && mReader.getTimestamp(mReader.size() - 1) > mReader.getTimestamp(0))
+                mFramerate = (unsigned int)((double)(mReader.size() - 1) * 1e6 / (double)(mReader.getTimestamp(mReader.size() - 1) - mReader.getTimestamp(0)) + 0.5);
+
+            g_log(NULL, G_LOG_LEVEL_INFO, "%s: Replaying %lu frames from %s", mClassName.c_str(), (unsigned long)mReader.size(), location.c_str());
+        }
+
+        mIsPlaying = true;
+        mPlaybackThread.reset(new thread(&Source_2D_Recording::play, this));
+    }
+    else if (paramName == "playback")
+    {
+        int mode;
+        if (!readParam(pParam, mode))
+            return;
+        mPlayback = max((int)originalCadence, min((int)asFastAsPossible, mode));
+        mRestart = true;
+    }
+    else if (paramName == "playbackRate")
+    {
+        float rate;
+        if (!readParam(pParam, rate))
+            return;
+        mPlaybackRate = max(0.001f, rate);
+        mRestart = true;
+    }
+    else if (paramName == "loop")
+    {
+        int loop;
+        if (!readParam(pParam, loop))
+            return;
+        mLoop = (loop != 0);
+    }
+    else if (paramName == "position")
+    {
+        int position;
+        if (!readParam(pParam, position))
+            return;
+        mPosition = max(0, position);
+        mRestart = true;
+    }
+    else
+        setBaseParameter(pParam);
+}
+
+/*************/
+atom::Message Source_2D_Recording::getParameter(atom::Message pParam) const
+{
+    atom::Message msg;
+
+    if (pParam.size() < 1)
+        return msg;
+
+    string paramName;
+    try
+    {
+        paramName = atom::toString(pParam[0]);
+    }
+    catch (atom::BadTypeTagError exception)
+    {
+        return msg;
+    }
+
+    msg.push_back(pParam[0]);
+    if (paramName == "width")
+        msg.push_back(atom::IntValue::create(mWidth));
+    else if (paramName == "height")
+        msg.push_back(atom::IntValue::create(mHeight));
+    else if (paramName == "framerate")
+        msg.push_back(atom::IntValue::create(mFramerate));
+    else if (paramName == "subsourcenbr")
+        msg.push_back(atom::StringValue::create(mSubsourceNbr.c_str()));
+    else if (paramName == "frames")
+    {
+        lock_guard<mutex> lock(mMutex);
+        msg.push_back(atom::IntValue::create((int)mReader.size()));
+    }
+    else if (paramName == "position")
+        msg.push_back(atom::IntValue::create((int)mPosition));
+    else
+        msg = getBaseParameter(pParam);
+
+    return msg;
+}
+
+/*************/
+atom::Message Source_2D_Recording::getSubsources() const
+{
+    atom::Message message;
+
+    return message;
+}
@@ -3,6 +3,153 @@
 using namespace std;
 
 #if HAVE_PCL && HAVE_SHMDATA
+#include <cmath>
+#include <limits>
+#include <stdint.h>
+#include <unordered_map>
+
+#define VOXEL_KEY_BITS 21
+#define VOXEL_INVALID_KEY numeric_limits<uint64_t>::max()
+
+/*************/
+// Voxels are split in partitions by hash, so that each partition can be accumulated independently without merging
+static inline unsigned int getVoxelPartition(uint64_t key, unsigned int partitionNbr)
+{
+    return (unsigned int)(((key * 0x9E3779B97F4A7C15ull) >> 32) % partitionNbr);
+}
+
+/*************/
+// Computes the voxel key of each point, or an invalid key for points outside the crop box.
+// If partitions is not NULL, the partition of each point is stored too, partitionNbr for invalid points
+class Parallel_VoxelKeys : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_VoxelKeys(const pcl::PointCloud<pcl::PointXYZRGBA>* cloud, float voxelSize, const float* cropBox, vector<uint64_t>* keys,
+            unsigned int partitionNbr = 0, vector<unsigned int>* partitions = NULL):
+            _cloud(cloud), _invSize(voxelSize > 0.f ? 1.f / voxelSize : 0.f), _cropBox(cropBox), _keys(keys),
+            _partitionNbr(partitionNbr), _partitions(partitions) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const long long offset = 1ll << (VOXEL_KEY_BITS - 1);
+            const long long maxIndex = (1ll << VOXEL_KEY_BITS) - 1;
+
+            for (int i = r.start; i < r.end; ++i)
+            {
+                const pcl::PointXYZRGBA& point = _cloud->points[i];
+                uint64_t& key = (*_keys)[i];
+
+                if (!std::isfinite(point.x) || !std::isfinite(point.y) || !std::isfinite(point.z))
+                {
+                    key = VOXEL_INVALID_KEY;
+                    continue;
+                }
+
+                if (_cropBox != NULL && (point.x < _cropBox[0] || point.x > _cropBox[1] || point.y < _cropBox[2] || point.y > _cropBox[3]
+                    || point.z < _cropBox[4] || point.z > _cropBox[5]))
+                {
+                    key = VOXEL_INVALID_KEY;
+                    continue;
+                }
+
+                if (_invSize == 0.f)
+                {
+                    key = 0;
+                    continue;
+                }
+
+                long long x = min(maxIndex, max(0ll, (long long)floor(point.x * _invSize) + offset));
+                long long y = min(maxIndex, max(0ll, (long long)floor(point.y * _invSize) + offset));
+                long long z = min(maxIndex, max(0ll, (long long)floor(point.z * _invSize) + offset));
+                key = (uint64_t)x | ((uint64_t)y << VOXEL_KEY_BITS) | ((uint64_t)z << (2 * VOXEL_KEY_BITS));
+            }
+
+            if (_partitions != NULL)
+                for (int i = r.start; i < r.end; ++i)
+                {
+                    uint64_t key = (*_keys)[i];
+                    (*_partitions)[i] = key == VOXEL_INVALID_KEY ? _partitionNbr : getVoxelPartition(key, _partitionNbr);
+                }
+        }
+
+    private:
+        const pcl::PointCloud<pcl::PointXYZRGBA>* _cloud;
+        float _invSize;
+        const float* _cropBox;
+        vector<uint64_t>* _keys;
+        unsigned int _partitionNbr;
+        vector<unsigned int>* _partitions;
+};
+
+/*************/
+// Averages the points of each voxel, one partition at a time. The point indices are sorted by partition,
+// partition p holding indices[offsets[p]] to indices[offsets[p + 1]]
+class Parallel_VoxelGrid : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_VoxelGrid(const pcl::PointCloud<pcl::PointXYZRGBA>* cloud, const vector<uint64_t>* keys, const vector<unsigned int>* indices,
+            const vector<unsigned int>* offsets, vector<vector<pcl::PointXYZRGBA>>* partitions):
+            _cloud(cloud), _keys(keys), _indices(indices), _offsets(offsets), _partitions(partitions) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            for (int p = r.start; p < r.end; ++p)
+            {
+                const unsigned int start = (*_offsets)[p];
+                const unsigned int end = (*_offsets)[p + 1];
+
+                unordered_map<uint64_t, Voxel> voxels;
+                voxels.reserve(end - start);
+                for (unsigned int n = start; n < end; ++n)
+                {
+                    const unsigned int i = (*_indices)[n];
+                    const pcl::PointXYZRGBA& point = _cloud->points[i];
+                    Voxel& voxel = voxels[(*_keys)[i]];
+                    voxel.x += point.x;
+                    voxel.y += point.y;
+                    voxel.z += point.z;
+                    voxel.r += point.r;
+                    voxel.g += point.g;
+                    voxel.b += point.b;
+                    voxel.a += point.a;
+                    voxel.count++;
+                }
+
+                vector<pcl::PointXYZRGBA>& output = (*_partitions)[p];
+                output.clear();
+                output.reserve(voxels.size());
+                for (auto& it : voxels)
+                {
+                    const Voxel& voxel = it.second;
+                    float inv = 1.f / (float)voxel.count;
+                    pcl::PointXYZRGBA point;
+                    point.x = voxel.x * inv;
+                    point.y = voxel.y * inv;
+                    point.z = voxel.z * inv;
+                    point.r = (uint8_t)(voxel.r / voxel.count);
+                    point.g = (uint8_t)(voxel.g / voxel.count);
+                    point.b = (uint8_t)(voxel.b / voxel.count);
+                    point.a = (uint8_t)(voxel.a / voxel.count);
+                    output.push_back(point);
+                }
+            }
+        }
+
+    private:
+        struct Voxel
+        {
+            Voxel() : x(0.f), y(0.f), z(0.f), r(0), g(0), b(0), a(0), count(0) {}
+            float x, y, z;
+            unsigned int r, g, b, a;
+            unsigned int count;
+        };
+
+        const pcl::PointCloud<pcl::PointXYZRGBA>* _cloud;
+        const vector<uint64_t>* _keys;
+        const vector<unsigned int>* _indices;
+        const vector<unsigned int>* _offsets;
+        vector<vector<pcl::PointXYZRGBA>>* _partitions;
+};
 
 std::string Source_3D_Shmdata::mClassName = "Source_3D_Shmdata";
 std::string Source_3D_Shmdata::mDocumentation = "N/A";
@@ -25,6 +172,14 @@ void Source_3D_Shmdata::make(string pParam)
     mName = mClassName;
     mSubsourceNbr = pParam;
     mId = pParam;
+
+    mCaptureIndex = 0;
+    mUpdateCapture = true;
+
+    mVoxelSize = 0.f;
+    mCrop = false;
+    for (int i = 0; i < 6; ++i)
+        mCropBox[i] = 0.f;
 }
 
 /*************/
@@ -53,12 +208,80 @@ bool Source_3D_Shmdata::grabFrame()
 /*************/
 Capture_Ptr Source_3D_Shmdata::retrieveFrame()
 {
+    lock_guard<mutex> lock(mCaptureMutex);
+
+    if (mShm.get() == NULL)
+        return Capture_3D_PclRgba_Ptr(new Capture_3D_PclRgba());
+
     pcl::PointCloud<pcl::PointXYZRGBA>::Ptr pointCloud;
-    unsigned long long timestamp = mShm->getCloud(pointCloud);
+    unsigned long long index;
+    unsigned long long timestamp = mShm->getCloud(pointCloud, &index);
+
+    // The cloud is filtered once, whatever the number of consumers
+    if (mCapture.get() == NULL || index != mCaptureIndex || mUpdateCapture)
+    {
+        mCapture.reset(new Capture_3D_PclRgba(filterCloud(pointCloud)));
+        mCaptureIndex = index;
+        mUpdateCapture = false;
+    }
+
+    return mCapture;
+}
+
+/*************/
+pcl::PointCloud<pcl::PointXYZRGBA>::Ptr Source_3D_Shmdata::filterCloud(const pcl::PointCloud<pcl::PointXYZRGBA>::Ptr& pCloud)
+{
+    if (pCloud.get() == NULL || (mVoxelSize <= 0.f && !mCrop))
+        return pCloud;
+
+    const size_t size = pCloud->size();
+    const unsigned int partitionNbr = max(1, cv::getNumberOfCPUs());
+    vector<uint64_t> keys(size);
+    vector<unsigned int> partitionIds(mVoxelSize > 0.f ? size : 0);
+    cv::parallel_for_(cv::Range(0, size), Parallel_VoxelKeys(pCloud.get(), mVoxelSize, mCrop ? mCropBox : NULL, &keys,
+        partitionNbr, mVoxelSize > 0.f ? &partitionIds : NULL));
+
+    pcl::PointCloud<pcl::PointXYZRGBA>::Ptr output(new pcl::PointCloud<pcl::PointXYZRGBA>());
+    if (mVoxelSize <= 0.f)
+    {
+        // Crop only
+        output->reserve(size);
+        for (size_t i = 0; i < size; ++i)
+            if (keys[i] != VOXEL_INVALID_KEY)
+                output->push_back(pCloud->points[i]);
+    }
+    else
+    {
+        // Counting sort of the valid points by partition, so that each partition only goes through its own points
+        vector<unsigned int> offsets(partitionNbr + 2, 0);
+        for (size_t i = 0; i < size; ++i)
+            offsets[partitionIds[i] + 1]++;
+        for (unsigned int p = 0; p <= partitionNbr; ++p)
+            offsets[p + 1] += offsets[p];
 
-    Capture_3D_PclRgba_Ptr capture(new Capture_3D_PclRgba(pointCloud));
+        vector<unsigned int> indices(offsets[partitionNbr]);
+        vector<unsigned int> next(offsets.begin(), offsets.end() - 1);
+        for (size_t i = 0; i < size; ++i)
+            if (partitionIds[i] < partitionNbr)
+                indices[next[partitionIds[i]]++] = i;
 
-    return capture;
+        vector<vector<pcl::PointXYZRGBA>> partitions(partitionNbr);
+        cv::parallel_for_(cv::Range(0, partitionNbr), Parallel_VoxelGrid(pCloud.get(), &keys, &indices, &offsets, &partitions));
+
+        size_t total = 0;
+        for (auto& partition : partitions)
+            total += partition.size();
+        output->reserve(total);
+        for (auto& partition : partitions)
+            output->points.insert(output->points.end(), partition.begin(), partition.end());
+    }
+
+    output->width = output->points.size();
+    output->height = 1;
+    output->is_dense = true;
+    output->header = pCloud->header;
+
+    return output;
 }
 
 /*************/
@@ -82,7 +305,41 @@ void Source_3D_Shmdata::setParameter(atom::Message pParam)
         if (!readParam(pParam, location))
             return;
 
+        lock_guard<mutex> lock(mCaptureMutex);
         mShm.reset(new ShmPointCloud<pcl::PointXYZRGBA>(location.c_str(), false));
+        mUpdateCapture = true;
+    }
+    else if (paramName == "voxelGrid")
+    {
+        float size;
+        if (!readParam(pParam, size))
+            return;
+
+        lock_guard<mutex> lock(mCaptureMutex);
+        mVoxelSize = max(0.f, size);
+        mUpdateCapture = true;
+    }
+    else if (paramName == "crop")
+    {
+        float box[6];
+        for (int i = 0; i < 6; ++i)
+        {
+            if (!readParam(pParam, box[i], i + 1))
+            {
+                g_log(NULL, G_LOG_LEVEL_WARNING, "%s - Message wrongly formed for crop", mClassName.c_str());
+                return;
+            }
+        }
+
+        lock_guard<mutex> lock(mCaptureMutex);
+        mCrop = false;
+        for (int i = 0; i < 6; ++i)
+        {
+            mCropBox[i] = box[i];
+            if (box[i] != 0.f)
+                mCrop = true;
+        }
+        mUpdateCapture = true;
     }
 }
 
@@ -0,0 +1,224 @@
+#include "tonemapper.h"
+
+#include <limits>
+#include <memory>
+#include <mutex>
+
+#if CV_SSE2
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+#define LUT_SIZE 4096
+#define HISTOGRAM_SIZE 1024
+
+/*************/
+// Computes the maximum value of an image
+class Parallel_Max : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Max(const cv::Mat* image, float* maximum):
+            _image(image), _maximum(maximum)
+        {
+            _mutex.reset(new mutex());
+        }
+
+        void operator()(const cv::Range& r) const
+        {
+            const int length = _image->cols * _image->channels();
+            float localMax = 0.f;
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const float* values = _image->ptr<float>(y);
+                int x = 0;
+#if CV_SSE2
+                __m128 maxVec = _mm_setzero_ps();
+                for (; x + 4 <= length; x += 4)
+                    maxVec = _mm_max_ps(maxVec, _mm_loadu_ps(values + x));
+                float maxima[4];
+                _mm_storeu_ps(maxima, maxVec);
+                localMax = max(localMax, max(max(maxima[0], maxima[1]), max(maxima[2], maxima[3])));
+#endif
+                for (; x < length; ++x)
+                    localMax = max(localMax, values[x]);
+            }
+
+            lock_guard<mutex> lock(*_mutex.get());
+            *_maximum = max(*_maximum, localMax);
+        }
+
+    private:
+        const cv::Mat* _image;
+        float* _maximum;
+        shared_ptr<mutex> _mutex;
+};
+
+/*************/
+// Computes the histogram of an image, between 0 and a maximum value
+class Parallel_Histogram : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Histogram(const cv::Mat* image, float maximum, vector<unsigned int>* histogram):
+            _image(image), _scale((float)(HISTOGRAM_SIZE - 1) / maximum), _histogram(histogram)
+        {
+            _mutex.reset(new mutex());
+        }
+
+        void operator()(const cv::Range& r) const
+        {
+            const int length = _image->cols * _image->channels();
+            vector<unsigned int> histogram(HISTOGRAM_SIZE, 0);
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const float* values = _image->ptr<float>(y);
+                for (int x = 0; x < length; ++x)
+                {
+                    int bin = (int)(values[x] * _scale);
+                    histogram[max(0, min(HISTOGRAM_SIZE - 1, bin))]++;
+                }
+            }
+
+            lock_guard<mutex> lock(*_mutex.get());
+            for (int i = 0; i < HISTOGRAM_SIZE; ++i)
+                (*_histogram)[i] += histogram[i];
+        }
+
+    private:
+        const cv::Mat* _image;
+        float _scale;
+        vector<unsigned int>* _histogram;
+        shared_ptr<mutex> _mutex;
+};
+
+/*************/
+// Maps float values to 8 bits through a LUT
+class Parallel_Tonemap : public cv::ParallelLoopBody
+{
+    public:
+        Parallel_Tonemap(const cv::Mat* input, cv::Mat* output, float scale, const uchar* lut):
+            _input(input), _output(output), _scale(scale * (float)(LUT_SIZE - 1)), _lut(lut) {}
+
+        void operator()(const cv::Range& r) const
+        {
+            const int length = _input->cols * _input->channels();
+            for (int y = r.start; y < r.end; ++y)
+            {
+                const float* values = _input->ptr<float>(y);
+                uchar* output = _output->ptr<uchar>(y);
+                int x = 0;
+#if CV_SSE2
+                const __m128 scale = _mm_set1_ps(_scale);
+                const __m128 zero = _mm_setzero_ps();
+                const __m128 top = _mm_set1_ps((float)(LUT_SIZE - 1));
+                int indices[4];
+                for (; x + 4 <= length; x += 4)
+                {
+                    __m128 v = _mm_mul_ps(_mm_loadu_ps(values + x), scale);
+                    v = _mm_min_ps(_mm_max_ps(v, zero), top);
+                    _mm_storeu_si128((__m128i*)indices, _mm_cvtps_epi32(v));
+                    output[x] = _lut[indices[0]];
+                    output[x + 1] = _lut[indices[1]];
+                    output[x + 2] = _lut[indices[2]];
+                    output[x + 3] = _lut[indices[3]];
+                }
+#endif
+                for (; x < length; ++x)
+                {
+                    float v = max(0.f, min((float)(LUT_SIZE - 1), values[x] * _scale));
+                    output[x] = _lut[(int)(v + 0.5f)];
+                }
+            }
+        }
+
+    private:
+        const cv::Mat* _input;
+        cv::Mat* _output;
+        float _scale;
+        const uchar* _lut;
+};
+
+/*************/
+Tonemapper::Tonemapper()
+{
+    mOperator = gamma;
+    mPercentile = 100.f;
+    mGamma = 2.2f;
+    mReference = 1.f;
+
+    mLUT.resize(LUT_SIZE);
+    mUpdateLUT = true;
+}
+
+/*************/
+void Tonemapper::setOperator(tonemapOperator pOperator)
+{
+    mOperator = pOperator;
+    mUpdateLUT = true;
+}
+
+/*************/
+void Tonemapper::setGamma(float pGamma)
+{
+    mGamma = max(0.1f, pGamma);
+    mUpdateLUT = true;
+}
+
+/*************/
+bool Tonemapper::process(const cv::Mat& pInput, cv::Mat& pOutput)
+{
+    if (pInput.depth() != CV_32F || pInput.channels() > 4)
+        return false;
+
+    if (mUpdateLUT)
+        updateLUT();
+
+    mReference = computeReference(pInput);
+
+    cv::Mat output(pInput.size(), CV_MAKE_TYPE(CV_8U, pInput.channels()));
+    cv::parallel_for_(cv::Range(0, pInput.rows), Parallel_Tonemap(&pInput, &output, 1.f / mReference, mLUT.data()));
+    pOutput = output;
+
+    return true;
+}
+
+/*************/
+float Tonemapper::computeReference(const cv::Mat& pInput)
+{
+    float maximum = 0.f;
+    cv::parallel_for_(cv::Range(0, pInput.rows), Parallel_Max(&pInput, &maximum));
+    if (maximum <= 0.f)
+        return 1.f;
+
+    if (mPercentile >= 100.f)
+        return maximum;
+
+    vector<unsigned int> histogram(HISTOGRAM_SIZE, 0);
+    cv::parallel_for_(cv::Range(0, pInput.rows), Parallel_Histogram(&pInput, maximum, &histogram));
+
+    unsigned long long target = (unsigned long long)((double)pInput.total() * pInput.channels() * mPercentile / 100.0);
+    unsigned long long count = 0;
+    for (int i = 0; i < HISTOGRAM_SIZE; ++i)
+    {
+        count += histogram[i];
+        if (count >= target)
+            return max(numeric_limits<float>::min(), maximum * (float)(i + 1) / (float)(HISTOGRAM_SIZE - 1));
+    }
+
+    return maximum;
+}
+
+/*************/
+void Tonemapper::updateLUT()
+{
+    for (int i = 0; i < LUT_SIZE; ++i)
+    {
+        float value = (float)i / (float)(LUT_SIZE - 1);
+        if (mOperator == reinhard)
+            value = 2.f * value / (1.f + value);
+        value = pow(value, 1.f / mGamma);
+        mLUT[i] = cv::saturate_cast<uchar>(value * 255.f);
+    }
+
+    mUpdateLUT = false;
+}